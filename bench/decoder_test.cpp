@@ -0,0 +1,170 @@
+// decoder-test: RequestDecoder edge cases, run by `make decoder-test`.
+//
+// Each case decodes one body against a small schema and checks either the
+// decoded value or the start of the error message. Exits 1 on any failure.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "decoder.h"
+#include "uint256.h"
+
+struct TestParams
+{
+    int32_t num;
+    uint64_t id;
+    int64_t amount;
+    std::string_view text;
+    HexBytes tx;
+    uint256 txid;
+    unsigned char txBuf[4];
+};
+
+static const RequestField numFields[] = {
+    {"num", FIELD_INT, offsetof(TestParams, num), 0},
+};
+static const RequestField idFields[] = {
+    {"id", FIELD_UINT64, offsetof(TestParams, id), 0},
+};
+static const RequestField amountFields[] = {
+    {"amount", FIELD_DECIMAL, offsetof(TestParams, amount), 0},
+};
+static const RequestField textFields[] = {
+    {"text", FIELD_STRING, offsetof(TestParams, text), 8},
+};
+static const RequestField txFields[] = {
+    {"tx", FIELD_HEX, offsetof(TestParams, tx), 4},
+};
+static const RequestField txidFields[] = {
+    {"txid", FIELD_UINT256, offsetof(TestParams, txid), 0},
+};
+static const RequestField numIdFields[] = {
+    {"num", FIELD_INT, offsetof(TestParams, num), 0},
+    {"id", FIELD_UINT64, offsetof(TestParams, id), 0},
+};
+
+static int failures = 0;
+
+// Decodes body into params, whose views point into body and decoder. error
+// is empty when the decode should succeed, otherwise the expected start of
+// the decoder's message.
+static bool decode(RequestDecoder& decoder, const std::string& body, const RequestSchema& schema, TestParams& params,
+                   const char* error)
+{
+    params = TestParams();
+    params.tx.data = params.txBuf;
+    bool ok = decoder.Decode(schema, &params);
+    bool pass = *error ? !ok && decoder.Error().compare(0, strlen(error), error) == 0 : ok;
+    if (!pass)
+    {
+        printf("FAIL %s: %s, expected %s\n", body.c_str(), ok ? "decoded" : decoder.Error().c_str(),
+               *error ? error : "success");
+        failures++;
+    }
+    return pass && ok;
+}
+
+static void check(const std::string& body, const RequestSchema& schema, const char* error)
+{
+    TestParams params;
+    RequestDecoder decoder(body);
+    decode(decoder, body, schema, params, error);
+}
+
+static void expect(bool cond, const std::string& body, const char* what)
+{
+    if (cond)
+        return;
+    printf("FAIL %s: %s\n", body.c_str(), what);
+    failures++;
+}
+
+static std::string nested(int depth)
+{
+    return "{\"skip\":" + std::string(depth, '[') + std::string(depth, ']') + ",\"num\":1}";
+}
+
+int main()
+{
+    TestParams params;
+    std::string body;
+
+    // strings: surrogate pairs, UTF-8, control characters, maxLen
+    body = "{\"text\":\"\\ud83d\\ude00\"}";
+    if (RequestDecoder decoder(body); decode(decoder, body, textFields, params, ""))
+        expect(params.text == "\xF0\x9F\x98\x80", body, "U+1F600 not decoded to F0 9F 98 80");
+    check("{\"text\":\"\\ud83d\"}", textFields, "unpaired surrogate");
+    check("{\"text\":\"\\ud83dx\"}", textFields, "unpaired surrogate");
+    check("{\"text\":\"\\ude00\"}", textFields, "unpaired surrogate");
+    check("{\"text\":\"\\ud83d\\u0041\"}", textFields, "unpaired surrogate");
+    check("{\"text\":\"\\u12g4\"}", textFields, "bad \\u escape");
+    check("{\"text\":\"\xC3\x28\"}", textFields, "invalid UTF-8");
+    check("{\"text\":\"\xED\xA0\x80\"}", textFields, "invalid UTF-8");
+    check("{\"text\":\"a\x01\"}", textFields, "control character in string");
+    check("{\"text\":\"12345678\"}", textFields, "");
+    check("{\"text\":\"123456789\"}", textFields, "text: too long");
+
+    // skipped values nest at most MAX_SKIP_DEPTH deep
+    check(nested(32), numFields, "");
+    check(nested(33), numFields, "nested too deep");
+
+    // FIELD_INT is int32_t, FIELD_UINT64 uint64_t
+    body = "{\"num\":-2147483648}";
+    if (RequestDecoder decoder(body); decode(decoder, body, numFields, params, ""))
+        expect(params.num == INT32_MIN, body, "not INT32_MIN");
+    check("{\"num\":2147483647}", numFields, "");
+    check("{\"num\":2147483648}", numFields, "num: expected an integer in range");
+    check("{\"num\":-2147483649}", numFields, "num: expected an integer in range");
+    check("{\"num\":1.5}", numFields, "num: expected an integer in range");
+    body = "{\"id\":18446744073709551615}";
+    if (RequestDecoder decoder(body); decode(decoder, body, idFields, params, ""))
+        expect(params.id == UINT64_MAX, body, "not UINT64_MAX");
+    check("{\"id\":18446744073709551616}", idFields, "id: expected an integer in range");
+    check("{\"id\":-1}", idFields, "id: expected an integer in range");
+
+    // amounts, as numbers or strings, in satoshis
+    body = "{\"amount\":0.00000001}";
+    if (RequestDecoder decoder(body); decode(decoder, body, amountFields, params, ""))
+        expect(params.amount == 1, body, "not 1 satoshi");
+    body = "{\"amount\":\"12.34567891\"}";
+    if (RequestDecoder decoder(body); decode(decoder, body, amountFields, params, ""))
+        expect(params.amount == 1234567891, body, "not 1234567891 satoshis");
+    body = "{\"amount\":21000000}";
+    if (RequestDecoder decoder(body); decode(decoder, body, amountFields, params, ""))
+        expect(params.amount == 2100000000000000, body, "not MAX_MONEY");
+    check("{\"amount\":0.000000001}", amountFields, "amount: expected a decimal amount with at most 8 places");
+    check("{\"amount\":\"0.000000001\"}", amountFields, "amount: expected a decimal amount with at most 8 places");
+    check("{\"amount\":21000000.00000001}", amountFields, "amount: expected a decimal amount");
+    check("{\"amount\":-1}", amountFields, "amount: expected a decimal amount");
+    check("{\"amount\":\"1.\"}", amountFields, "amount: expected a decimal amount");
+    check("{\"amount\":\".5\"}", amountFields, "amount: expected a decimal amount");
+    check("{\"amount\":\"\"}", amountFields, "amount: expected a decimal amount");
+    check("{\"amount\":1.}", amountFields, "bad number");
+    check("{\"amount\":.5}", amountFields, "amount: expected a decimal amount");
+
+    // FIELD_HEX takes at most maxLen decoded bytes
+    body = "{\"tx\":\"deadBEEF\"}";
+    if (RequestDecoder decoder(body); decode(decoder, body, txFields, params, ""))
+        expect(params.tx.len == 4 && memcmp(params.tx.data, "\xDE\xAD\xBE\xEF", 4) == 0, body, "bytes differ");
+    check("{\"tx\":\"deadbeef00\"}", txFields, "tx: too long");
+    check("{\"tx\":\"dea\"}", txFields, "tx: expected hex digit pairs");
+    check("{\"tx\":\"deag\"}", txFields, "tx: expected hex digit pairs");
+    check("{\"txid\":\"" + std::string(64, 'a') + "\"}", txidFields, "");
+    check("{\"txid\":\"" + std::string(63, 'a') + "\"}", txidFields, "txid: expected 64 hex digits");
+
+    // whole body, every field required
+    check("{\"num\":1} ", numFields, "");
+    check("{\"num\":1}x", numFields, "trailing characters");
+    check("{\"num\":1}{}", numFields, "trailing characters");
+    check("{\"num\":1}", numIdFields, "id: missing");
+    check("{\"num\":1,\"id\":2,\"extra\":{\"a\":[true,null,\"\"]}}", numIdFields, "");
+
+    if (failures)
+    {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("decoder: all passed\n");
+    return 0;
+}
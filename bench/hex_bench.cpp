@@ -0,0 +1,139 @@
+// hex-bench: hex validation, decoding and encoding throughput, the loops
+// the relay used before against the vectorized isHex/decodeHex/HexStr.
+//
+// usage: hex-bench [-s bytes] [-t seconds]
+// Runs at 32 bytes (a txid), 1KB (a fund tx) and the -s size.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "server.h"
+
+// the loops isHex and decodeHex ran before, kept here as the baseline
+static bool tableIsHex(const std::string& str)
+{
+    for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
+    {
+        if (hexDigit(*it) < 0)
+            return false;
+    }
+    return (str.size() > 0) && (str.size()%2 == 0);
+}
+
+static bool tableDecodeHex(std::string_view hex, unsigned char* out, size_t len)
+{
+    if (hex.size() != len * 2)
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        signed char hi = hexDigit(hex[2 * i]);
+        signed char lo = hexDigit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+// HexStr as it was: a character at a time into a 3x reservation
+static std::string tableHexStr(const unsigned char* itbegin, const unsigned char* itend)
+{
+    std::string rv;
+    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    rv.reserve((itend-itbegin)*3);
+    for(const unsigned char* it = itbegin; it < itend; ++it)
+    {
+        rv.push_back(hexmap[*it>>4]);
+        rv.push_back(hexmap[*it&15]);
+    }
+    return rv;
+}
+
+// defeats dead code elimination of the results
+static volatile unsigned sink;
+
+// runs f over the input for about seconds, returns GB/s of hex consumed
+template<typename F>
+static double measure(double seconds, size_t hexLen, F f)
+{
+    using clock = std::chrono::steady_clock;
+    uint64_t iterations = 0;
+    auto start = clock::now();
+    auto deadline = start + std::chrono::duration<double>(seconds);
+    while (clock::now() < deadline)
+    {
+        for (int i = 0; i < 256; i++)
+            sink = sink + f();
+        iterations += 256;
+    }
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    return iterations * hexLen / elapsed / 1e9;
+}
+
+static void run(size_t bytes, double seconds)
+{
+    std::mt19937 rng(bytes);
+    std::vector<unsigned char> raw(bytes);
+    for (auto& b : raw)
+        b = rng();
+    // mixed case, so both letter ranges are exercised
+    std::string hex = HexStr(raw);
+    if (hex != tableHexStr(raw.data(), raw.data() + bytes))
+    {
+        fprintf(stderr, "HexStr mismatch at %zu bytes\n", bytes);
+        exit(1);
+    }
+    for (size_t i = 0; i < hex.size(); i += 3)
+        hex[i] = toupper(hex[i]);
+    std::vector<unsigned char> out(bytes);
+
+    if (!isHex(hex) || !decodeHex(hex, out.data(), bytes) || out != raw)
+    {
+        fprintf(stderr, "decodeHex mismatch at %zu bytes\n", bytes);
+        exit(1);
+    }
+
+    double tableCheck = measure(seconds, hex.size(), [&] { return tableIsHex(hex); });
+    double simdCheck = measure(seconds, hex.size(), [&] { return isHex(hex); });
+    double tableDecode = measure(seconds, hex.size(), [&] { return tableDecodeHex(hex, out.data(), bytes); });
+    double simdDecode = measure(seconds, hex.size(), [&] { return decodeHex(hex, out.data(), bytes); });
+    const unsigned char* p = raw.data();
+    double tableEncode = measure(seconds, hex.size(), [&] { return tableHexStr(p, p + bytes).size(); });
+    double simdEncode = measure(seconds, hex.size(), [&] { return HexStr(p, p + bytes).size(); });
+    printf("%-10zu %10.2f %10.2f %7.1fx %10.2f %10.2f %7.1fx %10.2f %10.2f %7.1fx\n", bytes,
+           tableCheck, simdCheck, simdCheck / tableCheck, tableDecode, simdDecode, simdDecode / tableDecode,
+           tableEncode, simdEncode, simdEncode / tableEncode);
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = 1 << 20;
+    double seconds = 0.5;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': size = strtoull(optarg, nullptr, 10); break;
+        case 't': seconds = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s bytes] [-t seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("hex implementation: %s, GB/s of hex digits\n", hexImpl());
+    printf("%-10s %10s %10s %8s %10s %10s %8s %10s %10s %8s\n", "bytes", "isHex/tbl", "isHex", "",
+           "decode/tbl", "decode", "", "HexStr/tbl", "HexStr", "");
+    run(32, seconds);
+    run(1024, seconds);
+    run(size, seconds);
+    return 0;
+}
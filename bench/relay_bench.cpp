@@ -0,0 +1,312 @@
+// relay-bench: plays the full dice protocol against a running relay.
+//
+// Every pair is two player threads, each with its own keep-alive curl
+// handle. A player joins with encodeNumber, waits for an opponent with
+// getSecret, funds with createFundTx, the first seat signs with signFundTx,
+// both wait on getFundTx, announce with anounceSecret and wait on getNum.
+// Players are matched by the relay itself, so a player's opponent is
+// whoever the relay pairs it with, as in production.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "curl/curl.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+enum Endpoint
+{
+    ENCODE_NUMBER,
+    GET_SECRET,
+    CREATE_FUND_TX,
+    SIGN_FUND_TX,
+    GET_FUND_TX,
+    ANOUNCE_SECRET,
+    GET_NUM,
+    ENDPOINT_COUNT
+};
+
+static const char* endpointPath[ENDPOINT_COUNT] = {
+    "/encodeNumber", "/getSecret", "/createFundTx", "/signFundTx", "/getFundTx", "/anounceSecret", "/getNum"
+};
+
+struct BenchOptions
+{
+    std::string url = "http://127.0.0.1:9000";
+    int pairs = 8;
+    int games = 100;
+    int pollMicros = 1000;
+    int maxPolls = 5000;
+    std::string output = "relay-bench.json";
+};
+
+struct PlayerStats
+{
+    std::vector<uint32_t> latency[ENDPOINT_COUNT];   // microseconds
+    uint64_t errors[ENDPOINT_COUNT] = {};
+    uint64_t games = 0;
+};
+
+static std::atomic<bool> benchFailed(false);
+
+static size_t appendReply(void* ptr, size_t size, size_t nmemb, void* stream)
+{
+    ((std::string*)stream)->append((char*)ptr, size * nmemb);
+    return size * nmemb;
+}
+
+class Player
+{
+public:
+    Player(const BenchOptions& opt, unsigned seed):opt_(opt), rng_(seed)
+    {
+        curl_ = curl_easy_init();
+        headers_ = curl_slist_append(nullptr, "Content-Type: application/json");
+        curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers_);
+        curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, appendReply);
+        curl_easy_setopt(curl_, CURLOPT_WRITEDATA, (void*)&reply_);
+        curl_easy_setopt(curl_, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl_, CURLOPT_TCP_NODELAY, 1L);
+        curl_easy_setopt(curl_, CURLOPT_TIMEOUT, 20L);
+    }
+
+    ~Player()
+    {
+        curl_slist_free_all(headers_);
+        curl_easy_cleanup(curl_);
+    }
+
+    void Run(int games)
+    {
+        for (int i = 0; i < games && !benchFailed; i++)
+        {
+            if (PlayGame())
+                stats.games++;
+        }
+    }
+
+    PlayerStats stats;
+
+private:
+    // POSTs body to endpoint, returns the decoded reply or a null json
+    json Call(Endpoint ep, const json& body)
+    {
+        std::string url = opt_.url + endpointPath[ep];
+        std::string data = body.dump();
+        reply_.clear();
+        curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, data.c_str());
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, (long)data.size());
+
+        auto start = std::chrono::steady_clock::now();
+        CURLcode res = curl_easy_perform(curl_);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        long status = 0;
+        curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &status);
+        if (res != CURLE_OK || status != 200)
+        {
+            stats.errors[ep]++;
+            return json();
+        }
+        stats.latency[ep].push_back(us);
+        try
+        {
+            return json::parse(reply_);
+        }
+        catch (...)
+        {
+            stats.errors[ep]++;
+            return json();
+        }
+    }
+
+    // repeats a call until the relay reports code 0, i.e. the opponent caught up
+    json Poll(Endpoint ep, const json& body)
+    {
+        for (int i = 0; i < opt_.maxPolls && !benchFailed; i++)
+        {
+            json r = Call(ep, body);
+            if (r.is_object() && r.count("code") && r["code"].get<int>() == 0)
+                return r;
+            if (r.is_null())
+                return r;
+            usleep(opt_.pollMicros);
+        }
+        if (!benchFailed.exchange(true))
+            fprintf(stderr, "%s: gave up waiting for the opponent, stopping\n", endpointPath[ep]);
+        return json();
+    }
+
+    std::string RandomHex(size_t bytes)
+    {
+        static const char hexmap[] = "0123456789abcdef";
+        std::string s(bytes * 2, '0');
+        for (auto& c : s)
+            c = hexmap[rng_() & 15];
+        return s;
+    }
+
+    bool PlayGame()
+    {
+        json r = Call(ENCODE_NUMBER, {{"secret", RandomHex(32)}, {"address", "bitcoincash:" + RandomHex(20)}});
+        if (!r.is_object() || !r.count("roomid"))
+            return false;
+        json roomid = r["roomid"];
+        int uid = r["uid"].get<int>();
+        json room = {{"roomid", roomid}};
+
+        if (Poll(GET_SECRET, room).is_null())
+            return false;
+
+        char amount[32];
+        snprintf(amount, sizeof(amount), "0.%08u", (unsigned)(rng_() % 50000000 + 1000000));
+        r = Call(CREATE_FUND_TX, {{"roomid", roomid}, {"uid", uid}, {"txid", RandomHex(32)},
+                                  {"amount", amount}, {"vout", (int)(rng_() % 4)}});
+        if (r.is_null())
+            return false;
+
+        if (uid == 0)
+        {
+            if (Call(SIGN_FUND_TX, {{"roomid", roomid}, {"hex", RandomHex(370)}}).is_null())
+                return false;
+        }
+
+        if (Poll(GET_FUND_TX, room).is_null())
+            return false;
+
+        if (Call(ANOUNCE_SECRET, {{"roomid", roomid}, {"uid", uid}, {"num", (int)(rng_() % 6 + 1)}}).is_null())
+            return false;
+
+        return !Poll(GET_NUM, room).is_null();
+    }
+
+    const BenchOptions& opt_;
+    std::mt19937 rng_;
+    CURL* curl_;
+    struct curl_slist* headers_;
+    std::string reply_;
+};
+
+static double percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t idx = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[idx] / 1000.0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-u url] [-p pairs] [-g games per pair] [-i poll interval us] [-o output.json]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opt;
+    int c;
+    while ((c = getopt(argc, argv, "u:p:g:i:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'u': opt.url = optarg; break;
+        case 'p': opt.pairs = atoi(optarg); break;
+        case 'g': opt.games = atoi(optarg); break;
+        case 'i': opt.pollMicros = atoi(optarg); break;
+        case 'o': opt.output = optarg; break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opt.pairs <= 0 || opt.games <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    std::vector<std::unique_ptr<Player>> players;
+    std::random_device rd;
+    for (int i = 0; i < opt.pairs * 2; i++)
+        players.emplace_back(new Player(opt, rd()));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& p : players)
+    {
+        Player* player = p.get();
+        threads.emplace_back([player, &opt] { player->Run(opt.games); });
+    }
+    for (auto& t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    json result = json::object();
+    result["url"] = opt.url;
+    result["pairs"] = opt.pairs;
+    result["games_per_pair"] = opt.games;
+    result["seconds"] = seconds;
+
+    uint64_t games = 0, requests = 0, errors = 0;
+    json endpoints = json::object();
+    printf("%-16s %10s %10s %8s %10s %10s %10s\n", "endpoint", "requests", "req/s", "errors", "p50 ms", "p99 ms", "p999 ms");
+    for (int ep = 0; ep < ENDPOINT_COUNT; ep++)
+    {
+        std::vector<uint32_t> all;
+        uint64_t epErrors = 0;
+        for (auto& p : players)
+        {
+            all.insert(all.end(), p->stats.latency[ep].begin(), p->stats.latency[ep].end());
+            epErrors += p->stats.errors[ep];
+        }
+        std::sort(all.begin(), all.end());
+        requests += all.size();
+        errors += epErrors;
+
+        json e = json::object();
+        e["requests"] = all.size();
+        e["errors"] = epErrors;
+        e["rps"] = all.size() / seconds;
+        e["p50_ms"] = percentile(all, 0.50);
+        e["p99_ms"] = percentile(all, 0.99);
+        e["p999_ms"] = percentile(all, 0.999);
+        endpoints[endpointPath[ep] + 1] = e;
+
+        printf("%-16s %10zu %10.0f %8llu %10.3f %10.3f %10.3f\n", endpointPath[ep] + 1, all.size(), all.size() / seconds,
+               (unsigned long long)epErrors, percentile(all, 0.50), percentile(all, 0.99), percentile(all, 0.999));
+    }
+    for (auto& p : players)
+        games += p->stats.games;
+
+    // every game is played by two players
+    result["games"] = games / 2;
+    result["games_per_second"] = games / 2 / seconds;
+    result["requests"] = requests;
+    result["requests_per_second"] = requests / seconds;
+    result["errors"] = errors;
+    result["endpoints"] = endpoints;
+
+    printf("%llu games, %llu requests in %.2fs: %.0f req/s, %.1f games/s, %llu errors\n",
+           (unsigned long long)(games / 2), (unsigned long long)requests, seconds, requests / seconds,
+           games / 2 / seconds, (unsigned long long)errors);
+
+    std::ofstream out(opt.output);
+    out << result.dump(4) << std::endl;
+
+    curl_global_cleanup();
+    return errors ? 2 : 0;
+}
@@ -0,0 +1,153 @@
+// task-bench: Task handlers waiting on upstreams, all in one process.
+//
+// Runs the relay's HTTP front end with a single handler thread and one
+// route, a coroutine that waits -s ms on sleepFor and then uploads the
+// request body with ipfsAdd. A stub of the IPFS add API answers on
+// 127.0.0.1:5001. -n requests go out at once; a handler that blocked for
+// the sleep would need n * s ms on the one thread, a suspended one lets
+// the thread take the next request.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+static int sleepMs = 50;
+
+static Task slowTask(std::unique_ptr<HTTPRequest> req)
+{
+    bool slept = co_await sleepFor(std::chrono::milliseconds(sleepMs));
+    UpstreamResult added = co_await ipfsAdd(std::string(req->GetBody()));
+    if (!slept || !added.ok)
+    {
+        req->WriteReply(HTTP_INTERNAL, "upstream failed");
+        co_return;
+    }
+    req->WriteReply(HTTP_OK, std::move(added.data));
+}
+
+// /api/v0/add stub, one reply line with the Hash
+static void ipfsStubCb(struct evhttp_request* req, void* arg)
+{
+    static std::atomic<uint64_t> added{0};
+    struct evbuffer* out = evhttp_request_get_output_buffer(req);
+    evbuffer_add_printf(out, "{\"Name\":\"msg.txt\",\"Hash\":\"QmStub%llu\",\"Size\":\"%zu\"}\n",
+                        (unsigned long long)++added, evbuffer_get_length(evhttp_request_get_input_buffer(req)));
+    evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
+}
+
+static size_t collect(char* data, size_t size, size_t nmemb, void* arg)
+{
+    ((std::string*)arg)->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+int main(int argc, char* argv[])
+{
+    int requests = 300;
+    int port = 18555;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': requests = atoi(optarg); break;
+        case 's': sleepMs = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n requests] [-s sleep ms] [-p port]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    el::Loggers::reconfigureAllLoggers(el::ConfigurationType::ToStandardOutput, "false");
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    registerHTTPHandler("/slow", taskHandler<slowTask>);
+    if (!initHTTPServer("127.0.0.1", port, 30, 1, 1, requests) ||
+        !startUpstreams(64, 60, BitcoinRpcConfig()))
+    {
+        fprintf(stderr, "cannot start the server on port %d\n", port);
+        return 1;
+    }
+
+    // after initHTTPServer, which turns on libevent's locking
+    struct event_base* stubBase = event_base_new();
+    struct evhttp* stub = evhttp_new(stubBase);
+    if (!stub || evhttp_bind_socket(stub, "127.0.0.1", 5001) != 0)
+    {
+        fprintf(stderr, "cannot listen on 127.0.0.1:5001 for the IPFS stub\n");
+        return 1;
+    }
+    evhttp_set_cb(stub, "/api/v0/add", ipfsStubCb, nullptr);
+    std::thread stubThread([stubBase] { event_base_dispatch(stubBase); });
+    std::thread serverThread([] { runHTTPServer(); });
+
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/slow";
+    CURLM* multi = curl_multi_init();
+    std::vector<std::string> replies(requests);
+    std::vector<std::string> bodies(requests);
+    for (int i = 0; i < requests; i++)
+    {
+        bodies[i] = "upload " + std::to_string(i);
+        CURL* easy = curl_easy_init();
+        curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, bodies[i].c_str());
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, collect);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &replies[i]);
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, &replies[i]);
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT, 60L);
+        curl_multi_add_handle(multi, easy);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int running = requests;
+    while (running > 0)
+    {
+        curl_multi_perform(multi, &running);
+        if (running > 0)
+            curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    int ok = 0, failed = 0;
+    CURLMsg* msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi, &left)))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        long status = 0;
+        std::string* reply = nullptr;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&reply);
+        if (msg->data.result == CURLE_OK && status == HTTP_OK && reply->compare(0, 6, "QmStub") == 0)
+            ok++;
+        else
+            failed++;
+        curl_multi_remove_handle(multi, msg->easy_handle);
+        curl_easy_cleanup(msg->easy_handle);
+    }
+    curl_multi_cleanup(multi);
+
+    printf("%d requests, %d ok, %d failed in %.1f ms on 1 handler thread; blocking handlers: at least %d ms\n",
+           requests, ok, failed, ms, requests * sleepMs);
+
+    interruptHTTPServer();
+    serverThread.join();
+    stopUpstreams();
+    stopHTTPServer();
+    event_base_loopbreak(stubBase);
+    stubThread.join();
+    evhttp_free(stub);
+    event_base_free(stubBase);
+    return failed ? 1 : 0;
+}
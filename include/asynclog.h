@@ -0,0 +1,23 @@
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <stddef.h>
+#include <string>
+
+// Asynchronous backend for easylogging++. Once started, LOG() only copies
+// the message into a fixed-size record of a lock-free ring; a background
+// thread formats the records and writes them to the log file (and stdout when
+// the log config asks for it) in batches with writev(). Request latency then
+// no longer depends on disk or terminal speed.
+enum class AsyncLogPolicy
+{
+    DROP,   // a full ring drops the record and counts it
+    BLOCK   // a full ring makes the caller wait for the writer
+};
+
+bool startAsyncLog(size_t capacity, AsyncLogPolicy policy);
+
+// flushes what is queued and gives logging back to easylogging++
+void stopAsyncLog();
+
+#endif // ASYNCLOG_H
@@ -0,0 +1,79 @@
+#ifndef BITCOINRPC_H
+#define BITCOINRPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <event2/event.h>
+
+struct BitcoinRpcConfig
+{
+    std::string url = "http://127.0.0.1:8332";
+    std::string user = "hello";
+    std::string password = "helloworld";
+    size_t batchSize = 32;      // calls per JSON-RPC batch
+    int lingerMs = 2;           // how long a call waits for others to join it
+};
+
+// ok and, on success, the call's "result" as JSON text (e.g. "null" for a
+// missing txout); on failure a message saying what went wrong
+using BitcoinRpcDone = std::function<void(bool ok, std::string& result)>;
+
+// JSON-RPC client for bitcoind that merges calls. A call waits up to the
+// linger time for others to join it, and they go to the node together as
+// one batch array, one HTTP round trip, once the batch is full or the time
+// is up. Replies are matched back to callers by id. Calls can be made from
+// any thread; done runs on the thread that delivers the reply.
+class BitcoinRpc
+{
+public:
+    // posts a request body to the node and reports the HTTP reply body
+    using Send = std::function<void(std::string body, std::function<void(bool ok, std::string& reply)> done)>;
+
+    explicit BitcoinRpc(Send send);
+    ~BitcoinRpc();
+
+    // the linger timer runs on base
+    bool Start(struct event_base* base, size_t batchSize, int lingerMs);
+
+    // With the loop stopped: fails calls not sent yet. Sent ones finish
+    // with their transfer.
+    void Stop();
+
+    // params is the JSON array of the method's arguments, e.g. ["<txid>",0]
+    void Call(const std::string& method, const std::string& params, BitcoinRpcDone done);
+
+    uint64_t Calls() const { return calls_; }
+    uint64_t Batches() const { return batches_; }
+
+private:
+    struct Pending
+    {
+        uint64_t id;
+        BitcoinRpcDone done;
+    };
+
+    static void LingerCb(evutil_socket_t fd, short events, void* arg);
+    // with mtx_ held; the batch so far, leaving an empty one behind
+    void TakeBatch(std::string& body, std::vector<Pending>& calls);
+    void SendBatch(std::string body, std::vector<Pending> calls);
+    static void Dispatch(std::vector<Pending>& calls, bool ok, std::string& reply);
+
+    Send send_;
+    struct event* linger_;
+    struct timeval lingerTime_;
+    size_t batchSize_;
+    std::mutex mtx_;
+    bool stopped_;
+    uint64_t nextId_;
+    std::string body_;          // "[" and the calls so far, comma separated
+    std::vector<Pending> pending_;
+    std::atomic<uint64_t> calls_;
+    std::atomic<uint64_t> batches_;
+};
+
+#endif // BITCOINRPC_H
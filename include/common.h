@@ -3,7 +3,10 @@
 
 #include <string>
 #include <vector>
+#include <string_view>
+#include <type_traits>
 #include "json.hpp"
+#include "hexcodec.h"
 
 using json = nlohmann::json;
 
@@ -39,7 +42,17 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
     std::string rv;
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
-    rv.reserve((itend-itbegin)*3);
+    size_t n = itend - itbegin;
+    if constexpr (std::is_pointer<T>::value && sizeof(*itbegin) == 1)
+    {
+        if (!fSpaces)
+        {
+            rv.resize(2 * n);
+            encodeHex((const unsigned char*)itbegin, n, &rv[0]);
+            return rv;
+        }
+    }
+    rv.reserve(fSpaces && n ? 3 * n - 1 : 2 * n);
     for(T it = itbegin; it < itend; ++it)
     {
         unsigned char val = (unsigned char)(*it);
@@ -55,9 +68,23 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 template<typename T>
 inline std::string HexStr(const T& vch, bool fSpaces=false)
 {
-    return HexStr(vch.begin(), vch.end(), fSpaces);
+    return HexStr(vch.data(), vch.data() + vch.size(), fSpaces);
 }
 
+// bytes of an even-length hex string, empty when it is not one
+inline std::vector<unsigned char> ParseHex(std::string_view hex)
+{
+    std::vector<unsigned char> out(hex.size() / 2);
+    if (hex.size() % 2 != 0 || !decodeHex(hex, out.data(), out.size()))
+        out.clear();
+    return out;
+}
+
+// decimal coin amount, at most 8 places, to satoshis
+bool parseAmount(std::string_view str, int64_t& satoshis);
+
+std::string formatAmount(int64_t satoshis);
+
 template < class T>
 std::string makeReplyMsg(bool type,T& t)
 {
@@ -0,0 +1,77 @@
+#ifndef CURLPOOL_H
+#define CURLPOOL_H
+
+#include <stddef.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "curl/curl.h"
+
+// Reusable curl easy handles for one upstream. Handles share a CURLSH with
+// the DNS, connection and TLS session caches, so a request reuses a
+// keep-alive connection instead of connecting again, and a returned handle
+// skips handle setup next time. Handles past the idle limit are closed on
+// release. Handles left idle longer than the idle timeout are closed by
+// EvictIdle. Once nothing is idle or leased, the share goes too, taking its
+// connections with it.
+class CurlPool
+{
+public:
+    explicit CurlPool(const char* name);
+    ~CurlPool();
+
+    // idle handles kept, and the seconds one may stay unused
+    void SetLimits(size_t maxIdle, int idleSeconds);
+
+    // A handle with default options, apart from the shared caches and
+    // CURLOPT_NOSIGNAL. nullptr when curl cannot make one.
+    CURL* Acquire();
+
+    void Release(CURL* curl);
+
+    void EvictIdle();
+
+private:
+    struct Idle
+    {
+        CURL* curl;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    static void LockShare(CURL* curl, curl_lock_data data, curl_lock_access access, void* arg);
+    static void UnlockShare(CURL* curl, curl_lock_data data, void* arg);
+    // with mtx_ held
+    bool InitShare();
+    void Configure(CURL* curl);
+
+    const char* name_;
+    std::mutex mtx_;
+    std::vector<Idle> idle_;    // most recently released last
+    size_t leased_;
+    size_t maxIdle_;
+    int idleSeconds_;
+    CURLSH* share_;
+    std::mutex shareLocks_[CURL_LOCK_DATA_LAST];
+};
+
+// A handle leased from a pool for one scope
+class CurlLease
+{
+public:
+    explicit CurlLease(CurlPool& pool):pool_(pool), curl_(pool.Acquire()) {}
+    ~CurlLease()
+    {
+        if (curl_)
+            pool_.Release(curl_);
+    }
+    CurlLease(const CurlLease&) = delete;
+    CurlLease& operator=(const CurlLease&) = delete;
+
+    CURL* get() const { return curl_; }
+
+private:
+    CurlPool& pool_;
+    CURL* curl_;
+};
+
+#endif // CURLPOOL_H
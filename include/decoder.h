@@ -0,0 +1,86 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// One-pass JSON request decoder. An endpoint declares the fields it takes
+// and where they go in a plain struct; the body is scanned once, straight
+// into that struct, without building a DOM. Strings are views into the body
+// (or into one scratch buffer when they carry escapes), so decoding does not
+// allocate per field. The body must be UTF-8; validating it and finding the
+// end of each string are vectorized (jsonscan.h). Unknown fields are
+// validated and skipped; the first problem stops decoding with a message
+// naming the field or offset.
+
+enum FieldType
+{
+    FIELD_INT,          // JSON integer -> int32_t
+    FIELD_UINT64,       // non-negative JSON integer -> uint64_t
+    FIELD_UINT256,      // string of 64 hex digits -> uint256
+    FIELD_DECIMAL,      // coin amount, string or number, <= 8 places -> int64_t satoshis
+    FIELD_STRING,       // string -> std::string_view, at most maxLen bytes
+    FIELD_HEX,          // string of hex digit pairs -> HexBytes, at most maxLen bytes
+};
+
+// Destination of a FIELD_HEX field. The caller points data at a buffer of
+// maxLen bytes before decoding; the digits are checked and decoded into it
+// in one pass.
+struct HexBytes
+{
+    unsigned char* data;
+    size_t len;
+};
+
+struct RequestField
+{
+    const char* name;
+    FieldType type;
+    size_t offset;      // offsetof the destination in the request struct
+    size_t maxLen;      // FIELD_STRING bytes, FIELD_HEX decoded bytes
+};
+
+// Every field of a schema is required.
+struct RequestSchema
+{
+    template <size_t N>
+    constexpr RequestSchema(const RequestField (&f)[N]):fields(f), count(N)
+    {
+        static_assert(N <= 32, "too many request fields");
+    }
+
+    const RequestField* fields;
+    size_t count;
+};
+
+class RequestDecoder
+{
+public:
+    // views handed out point into body and into the decoder, both have to
+    // outlive the request struct
+    explicit RequestDecoder(std::string_view body);
+
+    bool Decode(const RequestSchema& schema, void* out);
+
+    const std::string& Error() const { return error_; }
+
+private:
+    bool Fail(const char* what);
+    bool FailField(const RequestField& field, const char* what);
+    void SkipSpace();
+    bool Expect(char c);
+    bool ParseString(std::string_view& out);
+    bool ParseNumber(std::string_view& out);
+    bool SkipValue();
+    bool DecodeField(const RequestField& field, char* out);
+
+    const char* begin_;
+    const char* p_;
+    const char* end_;
+    std::string scratch_;   // unescaped strings, reserved once to the body size
+    std::string error_;
+};
+
+#endif // DECODER_H
@@ -0,0 +1,24 @@
+#ifndef HEXCODEC_H
+#define HEXCODEC_H
+
+#include <stddef.h>
+#include <string_view>
+
+// Bulk hex conversion, with SSE2 and AVX2 versions picked from the CPU at
+// startup (see common.cpp). Encoding is lowercase.
+
+// non-empty, even-length run of hex digits
+bool isHex(std::string_view str);
+
+signed char hexDigit(char c);
+
+// exactly len bytes from 2 * len hex digits, checked as they are decoded
+bool decodeHex(std::string_view hex, unsigned char* out, size_t len);
+
+// 2 * len hex digits of data into out
+void encodeHex(const unsigned char* data, size_t len, char* out);
+
+// hex implementation in use
+const char* hexImpl();
+
+#endif // HEXCODEC_H
@@ -0,0 +1,22 @@
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+#include <stddef.h>
+
+// Vectorized scanning of request bodies, 32 bytes at a time with AVX2 or 16
+// with SSE2, picked once at startup from what the CPU supports. Other
+// targets get the scalar loops.
+
+// first byte in [p, end) that ends the plain part of a JSON string: a
+// quote, a backslash or a control character; end if there is none
+const char* findStringSpecial(const char* p, const char* end);
+
+// checks that [p, p + len) is well-formed UTF-8 (no overlongs, surrogates
+// or code points past U+10FFFF); on failure errorOffset is where the bad
+// sequence starts
+bool validateUtf8(const char* p, size_t len, size_t& errorOffset);
+
+// name of the implementation in use, for the startup log
+const char* jsonScanImpl();
+
+#endif // JSONSCAN_H
@@ -0,0 +1,62 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+struct evbuffer;
+
+// Streaming JSON writer that serializes straight into a reply evbuffer.
+// It reserves space in the buffer and writes into it in place, so a reply
+// is never built as a DOM or a std::string first. Commas are placed from
+// the nesting; callers only say what comes next:
+//
+//     JsonWriter w(req->ReplyBuffer());
+//     w.BeginObject().Key("roomid").UInt(id).Key("uid").Int(uid).EndObject();
+//     w.Finish();
+//
+// Between BeginEmbedded and EndEmbedded the JSON written becomes the
+// content of one string value, escaped as it goes. That is the shape of
+// the v1 replies, whose data is JSON text in a string.
+class JsonWriter
+{
+public:
+    explicit JsonWriter(struct evbuffer* out);
+    ~JsonWriter();
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& UInt(uint64_t value);
+    // lowercase hex of len bytes, as a string value
+    JsonWriter& Hex(const unsigned char* data, size_t len);
+    JsonWriter& BeginEmbedded();
+    JsonWriter& EndEmbedded();
+
+    // commits what was written to the evbuffer; the destructor does too
+    void Finish();
+
+private:
+    static const int MAX_DEPTH = 16;
+
+    void Value();
+    void Put(const char* p, size_t len);
+    void PutChar(char c) { Put(&c, 1); }
+    void PutRaw(const char* p, size_t len);
+    void PutEscaped(std::string_view s);
+    char* Reserve(size_t len);
+
+    struct evbuffer* out_;
+    char* base_;        // space reserved in out_
+    char* cur_;
+    char* end_;
+    bool first_[MAX_DEPTH];
+    int depth_;
+    bool afterKey_;
+    int embedded_;      // depth at which the embedded string started, or -1
+};
+
+#endif // JSONWRITER_H
@@ -0,0 +1,35 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+class HTTPRequest;
+
+// Request metrics. Every thread that records gets its own cache-line padded
+// counter block, written with plain relaxed stores and only summed when
+// /metrics is scraped, so the request path never takes a lock or bounces a
+// shared cache line.
+
+// Route 0 collects requests that matched no route. Routes are fixed once a
+// thread first records, which sizes its counter block; a later registration
+// is logged and gets route 0.
+int registerMetricsRoute(const std::string& path);
+
+void recordRequest(int route, int status, size_t bytesIn, size_t bytesOut, int64_t micros);
+
+enum RoomGauge
+{
+    ROOMS_LIVE,     // rooms whose game has not finished yet
+    ROOMS_TOTAL,    // entries in the room table
+    ROOM_GAUGE_COUNT
+};
+
+void addRoomGauge(RoomGauge gauge, int64_t delta);
+
+// GET /metrics, Prometheus text format
+void getMetrics(std::unique_ptr<HTTPRequest> req);
+
+#endif // METRICS_H
@@ -0,0 +1,114 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include "timerwheel.h"
+#include "uint256.h"
+
+// Room records. A room is split in two: the hot part the handlers check on
+// every request (phase, counters, links) is one cache line in the room slot
+// map, and the bulky player data sits at the same index in a separate cold
+// array that is only touched once a request gets past those checks. Every
+// field is fixed size, so neither part allocates.
+
+static const size_t ROOM_SECRET_MAX = 128;
+static const size_t ROOM_ADDRESS_MAX = 64;
+static const size_t ROOM_FUND_TX_MAX = 1024;   // raw bytes, twice that in hex
+static const uint32_t NO_ROOM = UINT32_MAX;
+
+// A room only moves forward. Every phase has its own deadline; a room that
+// sits in one phase past it is dropped, so abandoned games and finished ones
+// nobody polls any more do not pile up.
+enum RoomPhase
+{
+    ROOM_WAITING,       // one player, waiting for an opponent
+    ROOM_FUNDING,       // paired, waiting for both funding inputs
+    ROOM_ANOUNCING,     // funded, waiting for both numbers
+    ROOM_COMPLETE,      // both numbers in, kept so late getNum polls see them
+    ROOM_PHASE_COUNT
+};
+
+// WAL record types, one per room mutation. Strings are u16 length-prefixed.
+enum RoomLogType : uint8_t
+{
+    LOG_ROOM_CREATE = 1,    // id, secret, address of player 0
+    LOG_ROOM_JOIN,          // id, secret, address of player 1
+    LOG_ROOM_FUND,          // id, uid, txid, amount, vout
+    LOG_ROOM_SIGN,          // id, raw fund tx
+    LOG_ROOM_ANOUNCE,       // id, uid, num
+    LOG_ROOM_RELEASE,       // id
+};
+
+// Length-prefixed inline buffer
+template <size_t N>
+struct FixedBuffer
+{
+    uint16_t len;
+    char data[N];
+
+    bool Assign(std::string_view s)
+    {
+        if (s.size() > N)
+            return false;
+        memcpy(data, s.data(), s.size());
+        len = s.size();
+        return true;
+    }
+
+    std::string_view View() const { return std::string_view(data, len); }
+};
+
+struct GameInfo
+{
+    uint64_t room_id;
+    // deadline of the current phase in g_roomTimers, data is room_id
+    TimerNode timer;
+    // slot indices of the neighbours in g_waitingRooms, NO_ROOM at the ends
+    uint32_t wait_prev;
+    uint32_t wait_next;
+    uint8_t phase;
+    uint8_t user_size;
+    uint8_t vin_size;
+    uint8_t anounce_size;
+    bool waiting;
+
+    GameInfo()
+    {
+        room_id=0;
+        wait_prev=NO_ROOM;
+        wait_next=NO_ROOM;
+        phase=ROOM_WAITING;
+        user_size=0;
+        vin_size=0;
+        anounce_size=0;
+        waiting=false;
+    }
+};
+
+struct UserInfo
+{
+    FixedBuffer<ROOM_SECRET_MAX> secrect;
+    FixedBuffer<ROOM_ADDRESS_MAX> address;
+    uint256 txid;
+    int64_t amount;     // satoshis
+    int32_t vout;
+    int32_t num;
+};
+
+// Plain data, so the cold array can come zeroed straight from calloc and
+// only the pages of rooms actually used get committed.
+struct RoomCold
+{
+    UserInfo user_group[2];
+    FixedBuffer<ROOM_FUND_TX_MAX> fund_tx;   // raw bytes
+
+    void Reset()
+    {
+        memset(user_group, 0, sizeof(user_group));
+        fund_tx.len = 0;
+    }
+};
+
+#endif // ROOM_H
@@ -0,0 +1,50 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "server.h"
+
+// Route table for the fixed endpoint set. Routes are added once at startup,
+// then Build() picks a seed that gives every path its own slot, so a lookup
+// is one hash of the path, one slot and one compare however many routes
+// exist.
+class HTTPRouter
+{
+public:
+    enum MatchResult
+    {
+        MATCH,
+        NOT_FOUND,
+        BAD_METHOD
+    };
+
+    static uint32_t MethodBit(HTTPRequest::RequestMethod method) { return 1u << method; }
+
+    void Add(uint32_t methods, const std::string& path, HTTPRequestHandler handler, int id = 0);
+
+    bool Build();
+
+    // on MATCH and BAD_METHOD, id is set to the id the route was added with
+    MatchResult Match(HTTPRequest::RequestMethod method, std::string_view path, HTTPRequestHandler& handler, int& id) const;
+
+private:
+    struct Route
+    {
+        std::string path;
+        uint32_t methods;
+        HTTPRequestHandler handler;
+        int id;
+    };
+
+    static uint64_t Hash(std::string_view path, uint64_t seed);
+
+    std::vector<Route> routes_;
+    std::vector<int> slots_;    // index into routes_, -1 when empty
+    uint64_t seed_ = 0;
+    uint64_t mask_ = 0;
+};
+
+#endif // ROUTER_H
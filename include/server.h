@@ -8,7 +8,13 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <chrono>
 #include <event.h>
 #include <evhttp.h>
 #include <event2/keyvalq_struct.h>
@@ -19,30 +25,47 @@
 #include <event2/keyvalq_struct.h>
 #include "curl/curl.h"
 #include "easylogging++.h"
+#include "hexcodec.h"
+#include "task.h"
+#include "bitcoinrpc.h"
 
 #include <vector>
 
 class HTTPRequest;
-using HTTPRequestHandler = std::function<void(std::unique_ptr<HTTPRequest> req)>;
+using HTTPRequestHandler = void (*)(std::unique_ptr<HTTPRequest> req);
 
 //extern std::unique_ptr<CDatabaseObject> dbptr;
 
 static const std::string ERROR_REQUEST ="invalid request";
 
-struct HTTPPathHandler
+struct HTTPHeader
 {
-    HTTPPathHandler() {}
-    HTTPPathHandler(std::string _prefix, HTTPRequestHandler _handler):prefix(_prefix), handler(_handler){}
-    std::string prefix;
-    HTTPRequestHandler handler;
+    const char* key;
+    const char* value;
 };
-//
+
+// A fixed list of response headers, built once and reused for every reply.
+struct HTTPHeaderSet
+{
+    template<size_t N>
+    constexpr HTTPHeaderSet(const HTTPHeader (&_headers)[N]):headers(_headers), count(N){}
+    const HTTPHeader* headers;
+    size_t count;
+};
+
+extern const HTTPHeaderSet CORS_HEADERS;
+extern const HTTPHeaderSet JSON_HEADERS;
 
 
 class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    struct event_base* base;
+    std::thread::id loopThread;
+    bool replySent;
+    int route;
+    std::chrono::steady_clock::time_point startTime;
 public:
     HTTPRequest(struct evhttp_request* req);
     ~HTTPRequest();
@@ -57,19 +80,64 @@ public:
 		OPTIONS
     };
 
-    std::string GetURI();
+    // Views point into libevent's request and stay valid until the reply is
+    // written.
+    std::string_view GetURI();
+
+    // URI without the query string or fragment
+    std::string_view GetPath();
 
     RequestMethod GetRequestMethod();
 
-    std::string GetHeader();
+    // case-insensitive lookup of one request header
+    std::pair<bool, std::string_view> GetHeader(const char* hdr);
+
+    // Body as one contiguous view. Linearizes the input evbuffer only when
+    // the body arrived in several chunks.
+    std::string_view GetBody();
+
+    // Calls f(const char* data, size_t len) for each chunk of the body
+    // without copying or linearizing it.
+    template<typename F>
+    void ForEachBodyChunk(F f)
+    {
+        struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+        if (!buf)
+            return;
+        int n = evbuffer_peek(buf, -1, nullptr, nullptr, 0);
+        if (n <= 0)
+            return;
+        std::vector<struct evbuffer_iovec> chunks(n);
+        n = evbuffer_peek(buf, -1, nullptr, chunks.data(), n);
+        for (int i = 0; i < n; i++)
+        {
+            f((const char*)chunks[i].iov_base, chunks[i].iov_len);
+        }
+    }
 
     std::string ReadBody();
 
     void GetPeer();
 
+    // route id reported to the metrics when the reply is written
+    void SetRoute(int id) { route = id; }
+
     void WriteHeader(const std::string& hdr, const std::string& value);
 
+    void WriteHeaders(const HTTPHeaderSet& headers);
+
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    // Takes ownership of the reply and hands it to the output evbuffer by
+    // reference, so the body is not copied again.
+    void WriteReply(int nStatus, std::string&& strReply);
+
+    // Output evbuffer, for writers that serialize the body into it in place;
+    // WriteReply(nStatus) then sends what is there.
+    struct evbuffer* ReplyBuffer();
+
+private:
+    void SendReply(int nStatus);
 };
 
 void readconf();
@@ -82,23 +150,163 @@ int getTimeOut();
 
 bool isDaemon();
 
-void httpRequestCb(struct evhttp_request *req, void *arg);
+int getNetThreads();
+
+int getWorkThreads();
+
+int getWorkQueueDepth();
+
+bool isAsyncLog();
+
+int getLogQueueSize();
+
+bool isLogBlocking();
+
+int getRoomWaitTimeout();
+
+int getRoomFundTimeout();
+
+int getRoomAnounceTimeout();
+
+int getRoomCompleteTTL();
+
+int getMaxRooms();
+
+std::string getDataDir();
+
+int getWalSyncMs();
+
+int getSnapshotInterval();
+
+int getUpstreamPoolSize();
+
+int getUpstreamIdleTimeout();
+
+std::string getBitcoindUrl();
+
+std::string getBitcoindUser();
+
+std::string getBitcoindPassword();
+
+// JSON-RPC calls merged into one batch, and how long a call waits for more
+int getBitcoindBatchSize();
+
+int getBitcoindLingerMs();
 
-void registerHTTPHandler(const std::string &prefix,const HTTPRequestHandler &handler);
+// createFundTx checks the funding output against the node, on by default
+bool isUtxoCheck();
 
-bool isHex(const std::string& str);
+int getUtxoCacheSize();
 
-signed char hexDigit(char c);
+// seconds a missing output is remembered, and between chain tip polls
+int getUtxoNegativeTTL();
 
-bool checkHash(const std::string &txid);
+int getUtxoTipPoll();
+
+void httpRequestCb(struct evhttp_request *req, void *arg);
+
+void registerHTTPHandler(const std::string &path, HTTPRequestHandler handler, uint32_t methods = 1u << HTTPRequest::POST);
+
+// Handler entry for a coroutine handler, e.g. taskHandler<fooTask>: the
+// handler thread runs it up to its first co_await and moves on to the next
+// request while it waits.
+template<Task (*F)(std::unique_ptr<HTTPRequest> req)>
+void taskHandler(std::unique_ptr<HTTPRequest> req)
+{
+    F(std::move(req));
+}
+
+bool checkHash(std::string_view txid);
 
 void runDaemon(bool daemon);
 
-void signalHandler(int sig);
+void signalHandler(evutil_socket_t sig, short events, void *arg);
+
+bool initHTTPServer(const std::string& addr, int port, int timeout, int threads, int workthreads, int workqueue);
+
+void runHTTPServer();
+
+void interruptHTTPServer();
+
+void stopHTTPServer();
+
+// sizes the room table, call before the server starts
+void initRoomTable(int maxRooms);
+
+// loads the newest room snapshot in dir, replays the WAL after it, then logs
+// every room mutation to it
+bool openRoomLog(const std::string& dir, int syncMs);
+
+// snapshots the rooms every interval seconds, call after startRoomTimers
+bool startRoomSnapshots(int interval);
+
+void stopRoomSnapshots();
+
+// seconds a room may stay in each phase, call before openRoomLog so replayed
+// rooms get them too
+void setRoomTimeouts(int waitTimeout, int fundTimeout, int anounceTimeout, int completeTTL);
+
+// expires rooms stuck in a phase, call between initHTTPServer and runHTTPServer
+bool startRoomTimers();
+
+void stopRoomTimers();
+
+// keep-alive curl handles and the non-blocking client for the IPFS and
+// bitcoind upstreams, call between initHTTPServer and runHTTPServer
+bool startUpstreams(int poolSize, int idleSeconds, const BitcoinRpcConfig& bitcoind);
+
+void stopUpstreams();
+
+// createFundTx validation: a cache of gettxout answers, cleared when a
+// chain tip poll sees a new block. Call after startUpstreams.
+bool startUtxoCheck(size_t cacheSize, int negativeTtl, int tipPollSeconds);
+
+void stopUtxoCheck();
 
 bool contentToipfshash(const std::string &content, std::string &ipfsHash);
 
-CURLcode curl_post_req(const std::string &url, const std::string &postParams, std::string &filepath, std::string &response);
+// Non-blocking versions of the calls below: done runs on net thread 0 once
+// the upstream answers, so the caller does not wait. A handler that replies
+// from done moves its request into it, e.g. as a std::shared_ptr, which
+// keeps the request alive until the reply is written.
+void curlBitcoinReqAsync(std::string data, std::function<void(bool ok, std::string &response)> done);
+
+// see BitcoinRpc::Call
+void bitcoinRpcAsync(const std::string &method, const std::string &params, BitcoinRpcDone done);
+
+void contentToipfshashAsync(std::string content, std::function<void(bool ok, const std::string &ipfsHash)> done);
+
+struct UpstreamResult
+{
+    bool ok = false;
+    std::string data;   // the reply, or the hash for ipfsAdd
+};
+
+// Awaitables for Task handlers, over the calls above. The handler resumes
+// on net thread 0 once the call is done; sleepFor resumes it there after
+// delay, with false when no timer could be set.
+CallbackAwaiter<UpstreamResult> ipfsAdd(std::string content);
+
+// one bitcoind JSON-RPC call, batched with others issued around the same
+// time; data is the call's result as JSON text, or the error message
+CallbackAwaiter<UpstreamResult> rpcCall(std::string method, std::string params);
+
+CallbackAwaiter<bool> sleepFor(std::chrono::milliseconds delay);
+
+// Moves a Task handler back onto a handler thread, for work that must not
+// run on the loop an awaitable above resumed it on: room locks, the WAL.
+// Carries on in place when the handler threads are stopping.
+struct WorkerAwaiter
+{
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h);
+    void await_resume() {}
+};
+
+WorkerAwaiter resumeOnWorker();
+
+// upload, when not empty, is posted as a multipart file part instead of postParams
+CURLcode curl_post_req(const std::string &url, const std::string &postParams, std::string_view upload, std::string &response);
 
 size_t req_reply(void *ptr, size_t size, size_t nmemb, void *stream);
 
@@ -107,7 +315,8 @@ void encodeNumber(std::unique_ptr<HTTPRequest> req);
 
 void getSecret(std::unique_ptr<HTTPRequest> req);
 
-void createFundTx(std::unique_ptr<HTTPRequest> req);
+// Task handler, register as taskHandler<createFundTx>
+Task createFundTx(std::unique_ptr<HTTPRequest> req);
 
 void signFundTx(std::unique_ptr<HTTPRequest> req);
 
@@ -0,0 +1,140 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Fixed-capacity slot map. Values live in one contiguous array that never
+// reallocates, so pointers to them stay valid until they are erased.
+//
+// An id is (generation << INDEX_BITS) | index. The generation sits next to
+// the value in its slot, so a lookup is one array access and a compare,
+// and an id kept past Erase never matches the slot's next tenant. Ids stay
+// below 2^52 and survive a round trip through a JSON double.
+//
+// Slots are cache-line aligned; with a value of up to 56 bytes a lookup
+// touches exactly one line.
+template <typename T>
+class SlotMap
+{
+public:
+    static const int INDEX_BITS = 20;
+    static const size_t MAX_CAPACITY = (size_t)1 << INDEX_BITS;
+
+    void Init(size_t capacity)
+    {
+        if (capacity > MAX_CAPACITY)
+            capacity = MAX_CAPACITY;
+        slots_.assign(capacity, Slot());
+        freeHead_ = capacity ? 0 : NONE;
+        for (size_t i = 0; i < capacity; i++)
+            slots_[i].nextFree = i + 1 < capacity ? i + 1 : NONE;
+        size_ = 0;
+    }
+
+    // nullptr when every slot is taken
+    T* Insert(uint64_t& id)
+    {
+        if (freeHead_ == NONE)
+            return nullptr;
+        uint32_t index = freeHead_;
+        Slot& slot = slots_[index];
+        freeHead_ = slot.nextFree;
+        slot.generation++;      // odd while live
+        size_++;
+        id = ((uint64_t)slot.generation << INDEX_BITS) | index;
+        return &slot.value;
+    }
+
+    T* Get(uint64_t id)
+    {
+        uint64_t index = Index(id);
+        if (index >= slots_.size())
+            return nullptr;
+        Slot& slot = slots_[index];
+        if (slot.generation != (id >> INDEX_BITS) || !(slot.generation & 1))
+            return nullptr;
+        return &slot.value;
+    }
+
+    bool Erase(uint64_t id)
+    {
+        if (!Get(id))
+            return false;
+        uint32_t index = Index(id);
+        Slot& slot = slots_[index];
+        slot.value = T();
+        slot.generation++;
+        size_--;
+        // a slot whose generation is used up is retired rather than reused
+        if (slot.generation != UINT32_MAX - 1)
+        {
+            slot.nextFree = freeHead_;
+            freeHead_ = index;
+        }
+        return true;
+    }
+
+    // Recovery: makes id live in its slot, whatever the free list says.
+    // Call RebuildFreeList once every id is restored.
+    T* Restore(uint64_t id)
+    {
+        uint32_t index = Index(id);
+        uint32_t generation = id >> INDEX_BITS;
+        if (index >= slots_.size() || !(generation & 1))
+            return nullptr;
+        Slot& slot = slots_[index];
+        if (!(slot.generation & 1))
+            size_++;
+        slot.generation = generation;
+        slot.value = T();
+        return &slot.value;
+    }
+
+    void RebuildFreeList()
+    {
+        freeHead_ = NONE;
+        for (size_t i = slots_.size(); i-- > 0;)
+        {
+            if (!(slots_[i].generation & 1) && slots_[i].generation != UINT32_MAX - 1)
+            {
+                slots_[i].nextFree = freeHead_;
+                freeHead_ = i;
+            }
+        }
+    }
+
+    // Recovery: the generation a free slot resumes from
+    void SetGeneration(uint32_t index, uint32_t generation)
+    {
+        if (index < slots_.size() && !(slots_[index].generation & 1) && !(generation & 1))
+            slots_[index].generation = generation;
+    }
+
+    uint32_t Generation(uint32_t index) const { return slots_[index].generation; }
+
+    // the value in slot index, live or not
+    T* AtIndex(uint32_t index) { return &slots_[index].value; }
+
+    static uint32_t Index(uint64_t id) { return id & (MAX_CAPACITY - 1); }
+
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return slots_.size(); }
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct alignas(64) Slot
+    {
+        uint32_t generation = 0;
+        uint32_t nextFree = NONE;
+        T value;
+    };
+
+    std::vector<Slot> slots_;
+    uint32_t freeHead_ = NONE;
+    size_t size_ = 0;
+};
+
+#endif // SLOTMAP_H
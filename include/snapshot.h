@@ -0,0 +1,101 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "room.h"
+
+// Room table checkpoints. A snapshot is written by a forked child from its
+// copy-on-write image of the room table, while the parent keeps serving.
+// The parent rotates the WAL in the same critical section it forks in, so
+// snapshot N holds exactly what WAL segments below N hold, and those can
+// go once it is durable.
+//
+// The file is the header, then one generation per slot, then the live rooms
+// as fixed-size records, all at offsets the header gives. Loading maps it
+// and reads it in place, so restart time depends on the table size, not on
+// how much history led up to it.
+
+static const char SNAPSHOT_MAGIC[8] = {'R', 'L', 'Y', 'S', 'N', 'A', 'P', 0};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t walSeq;            // replay WAL segments from this one on
+    uint32_t capacity;          // slots, one generation each
+    uint32_t roomCount;
+    uint32_t roomSize;          // sizeof(SnapshotRoom)
+    uint32_t reserved;
+    uint64_t generationsOffset;
+    uint64_t roomsOffset;
+    uint64_t fileSize;
+};
+
+struct SnapshotRoom
+{
+    uint64_t room_id;
+    uint8_t phase;
+    uint8_t user_size;
+    uint8_t vin_size;
+    uint8_t anounce_size;
+    uint32_t reserved;
+    RoomCold cold;
+};
+
+// Buffered writer for the child: no allocation and nothing but system
+// calls, so it is safe after forking a multithreaded process.
+class SnapshotWriter
+{
+public:
+    // dir and seq name the file; the paths are built here, before the fork
+    SnapshotWriter(const std::string& dir, uint64_t seq);
+
+    bool Open();
+    bool Write(const void* p, size_t len);
+    // flushes, fsyncs and renames the file into place
+    bool Commit();
+
+private:
+    bool Flush();
+
+    char dir_[256];
+    char tmpPath_[320];
+    char path_[320];
+    int fd_;
+    size_t used_;
+    bool ok_;
+    char buf_[1 << 16];
+};
+
+// Read-only mapping of a snapshot file
+class SnapshotFile
+{
+public:
+    SnapshotFile();
+    ~SnapshotFile();
+
+    // maps path and checks the header against this build's layout
+    bool Open(const std::string& path);
+
+    const SnapshotHeader& Header() const { return *(const SnapshotHeader*)base_; }
+    const uint32_t* Generations() const { return (const uint32_t*)(base_ + Header().generationsOffset); }
+    const SnapshotRoom* Rooms() const { return (const SnapshotRoom*)(base_ + Header().roomsOffset); }
+
+private:
+    const char* base_;
+    size_t size_;
+};
+
+std::string snapshotPath(const std::string& dir, uint64_t seq);
+
+// newest snapshot in dir, false when there is none
+bool findSnapshot(const std::string& dir, uint64_t& seq);
+
+// removes snapshots older than seq, and leftovers of failed writes
+void pruneSnapshots(const std::string& dir, uint64_t seq);
+
+#endif // SNAPSHOT_H
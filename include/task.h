@@ -0,0 +1,72 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+#include "easylogging++.h"
+
+// Coroutine type for handlers that wait on upstream calls. A Task runs as
+// soon as it is called, up to its first suspension, and nothing joins it:
+// the frame, with the request moved into it, goes when the body returns.
+// After a co_await the body runs on whichever thread resumed it.
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object() { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            try
+            {
+                throw;
+            }
+            catch (const std::exception& e)
+            {
+                LOG(ERROR) << "task: unhandled exception: " << e.what();
+            }
+            catch (...)
+            {
+                LOG(ERROR) << "task: unhandled exception";
+            }
+        }
+    };
+};
+
+// Awaits an operation that reports its result through a callback. start
+// is given the callback and starts the operation, which must invoke the
+// callback exactly once; the coroutine resumes on that thread.
+template<typename T>
+class CallbackAwaiter
+{
+public:
+    using Start = std::function<void(std::function<void(T)>)>;
+
+    explicit CallbackAwaiter(Start start):start_(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        // The callback may resume h on another thread, and so destroy this
+        // awaiter, before start returns; nothing of it is touched after.
+        Start start = std::move(start_);
+        start([this, h](T result) {
+            result_ = std::move(result);
+            h.resume();
+        });
+    }
+
+    T await_resume() { return std::move(result_); }
+
+private:
+    Start start_;
+    T result_;
+};
+
+#endif // TASK_H
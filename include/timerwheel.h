@@ -0,0 +1,53 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+// Intrusive timer, embedded in the object it times. data is free for the
+// owner, e.g. the id to look the object up by when it fires.
+struct TimerNode
+{
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expires = 0;   // in ticks
+    uint64_t data = 0;
+
+    bool IsActive() const { return next != nullptr; }
+};
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, each level
+// SLOTS times coarser than the one below. Add and Remove are O(1); a tick
+// fires one level-0 slot and, every SLOTS ticks, re-files one slot of the
+// next level down. Not thread safe, the owner serializes access.
+class TimerWheel
+{
+public:
+    typedef void (*ExpireFn)(TimerNode* node);
+
+    static const int BITS = 6;
+    static const int SLOTS = 1 << BITS;
+    static const int LEVELS = 4;
+
+    explicit TimerWheel(ExpireFn onExpire);
+
+    uint64_t Now() const { return now_; }
+
+    // (re)arms node to fire after `ticks` ticks
+    void Schedule(TimerNode* node, uint64_t ticks);
+
+    void Cancel(TimerNode* node);
+
+    // runs the wheel forward to tick, firing everything that expires
+    void Advance(uint64_t tick);
+
+private:
+    void Insert(TimerNode* node);
+    void Cascade(int level, int slot);
+    void Tick();
+
+    TimerNode slots_[LEVELS][SLOTS];    // list heads, circular
+    uint64_t now_;
+    ExpireFn onExpire_;
+};
+
+#endif // TIMERWHEEL_H
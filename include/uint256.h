@@ -0,0 +1,64 @@
+#ifndef UINT256_H
+#define UINT256_H
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include "hexcodec.h"
+
+// 256-bit value kept as 32 raw bytes, for txids and hashes. The bytes are
+// in the order of the hex form, without Bitcoin's display reversal: the
+// relay only hands txids back as it got them. Hex is parsed and produced at
+// the JSON boundary only.
+//
+// Plain data like the rooms that hold it, so it is not zeroed on
+// construction; use uint256 v{} or SetNull().
+class uint256
+{
+public:
+    static const size_t WIDTH = 32;
+
+    // false, and the value untouched, unless hex is exactly 64 hex digits
+    bool SetHex(std::string_view hex)
+    {
+        unsigned char bytes[WIDTH];
+        if (!decodeHex(hex, bytes, WIDTH))
+            return false;
+        memcpy(data_, bytes, WIDTH);
+        return true;
+    }
+
+    std::string GetHex() const
+    {
+        std::string hex(2 * WIDTH, 0);
+        encodeHex(data_, WIDTH, &hex[0]);
+        return hex;
+    }
+
+    void SetNull() { memset(data_, 0, WIDTH); }
+
+    bool IsNull() const
+    {
+        static const unsigned char zero[WIDTH] = {};
+        return memcmp(data_, zero, WIDTH) == 0;
+    }
+
+    unsigned char* data() { return data_; }
+    const unsigned char* data() const { return data_; }
+    const unsigned char* begin() const { return data_; }
+    const unsigned char* end() const { return data_ + WIDTH; }
+    static constexpr size_t size() { return WIDTH; }
+
+    friend bool operator==(const uint256& a, const uint256& b) { return memcmp(a.data_, b.data_, WIDTH) == 0; }
+    friend bool operator!=(const uint256& a, const uint256& b) { return !(a == b); }
+    friend bool operator<(const uint256& a, const uint256& b) { return memcmp(a.data_, b.data_, WIDTH) < 0; }
+
+private:
+    unsigned char data_[WIDTH];
+};
+
+// stored in rooms and written to snapshots byte for byte
+static_assert(sizeof(uint256) == 32, "uint256 must be exactly 32 bytes");
+
+#endif // UINT256_H
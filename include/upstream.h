@@ -0,0 +1,82 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <event2/event.h>
+#include "curl/curl.h"
+#include "curlpool.h"
+
+// code is the transfer's result, status the HTTP status (0 when there was
+// no response) and reply the response body, which the callee may take
+using UpstreamDone = std::function<void(CURLcode code, long status, std::string& reply)>;
+
+// One upstream call. The caller sets the request options on easy. Whatever
+// easy points at must outlive the transfer, so it goes in the fields below,
+// which the client frees when the call ends.
+struct UpstreamCall
+{
+    CurlPool* pool;
+    CURL* easy;                 // leased from pool
+    std::string body;           // for CURLOPT_POSTFIELDS
+    curl_slist* headers;
+    curl_mime* mime;
+    std::string reply;
+    UpstreamDone done;
+};
+
+// Non-blocking upstream client. A curl multi handle is driven by one
+// event_base: curl's sockets and its timeout become libevent events, so
+// the loop thread keeps any number of transfers in flight without
+// blocking on one. Calls can be submitted from any thread; they are handed
+// to the loop, and done runs on the loop thread once the reply is in.
+class UpstreamClient
+{
+public:
+    UpstreamClient();
+    ~UpstreamClient();
+
+    // At most maxHostConnections connections per host, 0 for no limit;
+    // transfers past it wait for a connection to free up.
+    bool Start(struct event_base* base, long maxHostConnections);
+
+    // With the loop stopped: ends calls still in flight with
+    // CURLE_ABORTED_BY_CALLBACK and frees the multi handle.
+    void Stop();
+
+    // A call with a handle from pool, nullptr when there is none
+    UpstreamCall* NewCall(CurlPool& pool);
+
+    // Takes ownership of call. Also reports failures through done, after
+    // Stop or when the transfer cannot be started.
+    void Perform(UpstreamCall* call, UpstreamDone done);
+
+    size_t InFlight() const { return inFlight_; }
+
+private:
+    static int SocketCb(CURL* easy, curl_socket_t s, int what, void* arg, void* socketp);
+    static int TimerCb(CURLM* multi, long timeoutMs, void* arg);
+    static void EventCb(evutil_socket_t fd, short events, void* arg);
+    static void TimeoutCb(evutil_socket_t fd, short events, void* arg);
+    static void WakeCb(evutil_socket_t fd, short events, void* arg);
+    static size_t WriteCb(char* data, size_t size, size_t nmemb, void* arg);
+
+    void CheckDone();
+    void Finish(UpstreamCall* call, CURLcode code);
+
+    struct event_base* base_;
+    CURLM* multi_;
+    struct event* timer_;
+    struct event* wake_;
+    std::mutex mtx_;
+    std::vector<UpstreamCall*> submitted_;  // waiting for the loop to add them
+    std::vector<UpstreamCall*> running_;    // added to multi_, loop thread only
+    bool stopped_;
+    std::atomic<size_t> inFlight_;
+};
+
+#endif // UPSTREAM_H
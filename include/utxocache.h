@@ -0,0 +1,85 @@
+#ifndef UTXOCACHE_H
+#define UTXOCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "uint256.h"
+
+enum UtxoState
+{
+    UTXO_UNKNOWN,   // not cached, ask the node
+    UTXO_UNSPENT,
+    UTXO_MISSING    // spent or never existed
+};
+
+// Bounded cache of gettxout answers keyed by (txid, vout), least recently
+// used first out. Unspent outputs stay until the chain tip changes, when a
+// block may have spent them; missing ones also expire after the negative
+// TTL, since the output may yet show up. Lookups hand out the tip epoch,
+// and an answer stored with an older one is dropped, so a reply that
+// crossed a tip change is not cached. Thread safe.
+class UtxoCache
+{
+public:
+    UtxoCache();
+
+    void SetLimits(size_t capacity, int negativeTtlSeconds);
+
+    // value in satoshis when UTXO_UNSPENT; epoch is for the Put after a miss
+    UtxoState Lookup(const uint256& txid, uint32_t vout, int64_t& value, uint64_t& epoch);
+
+    void Put(const uint256& txid, uint32_t vout, UtxoState state, int64_t value, uint64_t epoch);
+
+    // Clears the cache when tip differs from the last one seen. Returns
+    // whether it did.
+    bool SetTip(const std::string& tip);
+
+    size_t Size();
+
+private:
+    struct Key
+    {
+        uint256 txid;
+        uint32_t vout;
+
+        bool operator==(const Key& other) const { return vout == other.vout && txid == other.txid; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            // txids are hashes already, a slice of one is as good as any
+            uint64_t h;
+            memcpy(&h, key.txid.data(), sizeof(h));
+            return h ^ (key.vout * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        UtxoState state;
+        int64_t value;
+        std::chrono::steady_clock::time_point expires;  // UTXO_MISSING only
+    };
+
+    // with mtx_ held
+    void Clear();
+
+    std::mutex mtx_;
+    std::list<Entry> lru_;      // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+    size_t capacity_;
+    std::chrono::seconds negativeTtl_;
+    std::string tip_;
+    uint64_t epoch_;
+};
+
+#endif // UTXOCACHE_H
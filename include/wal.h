@@ -0,0 +1,45 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Append-only write-ahead log. The log is a directory of numbered segment
+// files holding binary records:
+//
+//   [u32 payload length][u32 crc32c of type and payload][u8 type][payload]
+//
+// Appends only copy into an in-memory batch. A flusher thread writes and
+// fdatasyncs whatever has accumulated every syncMs milliseconds, so one sync
+// covers every mutation of the window (group commit). A mutation is durable
+// at most syncMs after it was made; with syncMs 0 the flusher syncs as soon
+// as anything is pending.
+
+typedef void (*WalReplayFn)(uint8_t type, const unsigned char* payload, size_t len);
+
+// Replays every segment in dir numbered fromSeq or later through replay,
+// oldest first, then opens the newest one for appending. A torn or corrupt
+// tail of the newest segment, left by a crash mid-write, is cut off;
+// corruption anywhere else fails.
+bool openWal(const std::string& dir, int syncMs, uint64_t fromSeq, WalReplayFn replay);
+
+// Thread safe. Callers that need records in mutation order append while
+// holding the lock that orders the mutations.
+void walAppend(uint8_t type, const void* payload, size_t len);
+
+// Starts a new segment: records appended before the call stay in the older
+// segments, records appended after go to the new one. Returns its number,
+// 0 when the log is not open or the new segment cannot be created, in which
+// case nothing changes.
+uint64_t rotateWal();
+
+// removes the segments numbered below seq, once a snapshot covers them
+void pruneWal(uint64_t seq);
+
+bool isWalOpen();
+
+// flushes and syncs what is pending, stops the flusher
+void closeWal();
+
+#endif // WAL_H
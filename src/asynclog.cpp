@@ -0,0 +1,302 @@
+#include "asynclog.h"
+#include "easylogging++.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// One ring slot. seq follows the bounded MPMC queue scheme: a slot is free
+// for the producer holding ticket pos when seq == pos, and readable by the
+// writer when seq == pos + 1.
+struct alignas(64) LogRecord
+{
+    std::atomic<size_t> seq;
+    int64_t time_us;
+    unsigned int level;
+    unsigned int line;
+    uint16_t file_len;
+    uint16_t msg_len;
+    char file[44];
+    char msg[440];
+};
+static_assert(sizeof(LogRecord) == 512, "log record should stay 512 bytes");
+
+const size_t WRITE_BATCH = 64;
+const size_t LINE_MAX_LEN = sizeof(LogRecord::msg) + sizeof(LogRecord::file) + 64;
+
+LogRecord* ring = nullptr;
+size_t ringMask = 0;
+AsyncLogPolicy ringPolicy = AsyncLogPolicy::DROP;
+alignas(64) std::atomic<size_t> ringTail(0);
+alignas(64) size_t ringHead = 0;                // writer thread only
+alignas(64) std::atomic<uint64_t> droppedRecords(0);
+
+std::atomic<bool> writerRunning(false);
+std::atomic<bool> writerIdle(false);
+std::mutex writerMutex;
+std::condition_variable writerCond;
+std::thread writerThread;
+
+int logFd = -1;
+bool logToStdout = false;
+size_t maxFileSize = 0;
+size_t fileSize = 0;
+
+void copyTail(char* dst, size_t cap, uint16_t& len, const std::string& src)
+{
+    // keep the end of long paths, that is the part that identifies the file
+    size_t n = std::min(src.size(), cap);
+    memcpy(dst, src.data() + src.size() - n, n);
+    len = n;
+}
+
+bool pushRecord(const el::LogMessage* m)
+{
+    size_t pos = ringTail.load(std::memory_order_relaxed);
+    LogRecord* rec;
+    while (true)
+    {
+        rec = &ring[pos & ringMask];
+        size_t seq = rec->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (ringTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            if (ringPolicy == AsyncLogPolicy::DROP || !writerRunning.load(std::memory_order_relaxed))
+            {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            writerCond.notify_one();
+            std::this_thread::yield();
+            pos = ringTail.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            pos = ringTail.load(std::memory_order_relaxed);
+        }
+    }
+
+    rec->time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count();
+    rec->level = (unsigned int)m->level();
+    rec->line = m->line();
+    copyTail(rec->file, sizeof(rec->file), rec->file_len, m->file());
+    const std::string& msg = m->message();
+    rec->msg_len = std::min(msg.size(), sizeof(rec->msg));
+    memcpy(rec->msg, msg.data(), rec->msg_len);
+    rec->seq.store(pos + 1, std::memory_order_release);
+
+    if (writerIdle.load(std::memory_order_relaxed))
+        writerCond.notify_one();
+    return true;
+}
+
+size_t formatRecord(const LogRecord* rec, char* out)
+{
+    static thread_local time_t cachedSec = 0;
+    static thread_local char cachedDate[32];
+    time_t sec = rec->time_us / 1000000;
+    if (sec != cachedSec)
+    {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cachedDate, sizeof(cachedDate), "%Y-%m-%d %H:%M:%S", &tm);
+        cachedSec = sec;
+    }
+
+    int n = snprintf(out, LINE_MAX_LEN, "%s,%03d  %-5s  %.*s%s - %.*s:%u\n",
+                     cachedDate, (int)((rec->time_us / 1000) % 1000),
+                     el::LevelHelper::convertToString((el::Level)rec->level),
+                     (int)rec->msg_len, rec->msg,
+                     rec->msg_len == sizeof(rec->msg) ? "..." : "",
+                     (int)rec->file_len, rec->file, rec->line);
+    return n < 0 ? 0 : std::min((size_t)n, LINE_MAX_LEN - 1);
+}
+
+void writeAll(int fd, struct iovec* iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void writeBatch(struct iovec* iov, int cnt, size_t bytes)
+{
+    if (logFd >= 0)
+    {
+        // same rollout rule as easylogging++: truncate once the file is full
+        if (maxFileSize > 0 && fileSize + bytes > maxFileSize)
+        {
+            if (ftruncate(logFd, 0) == 0)
+                fileSize = 0;
+        }
+        std::vector<struct iovec> copy(iov, iov + cnt);
+        writeAll(logFd, copy.data(), cnt);
+        fileSize += bytes;
+    }
+    if (logToStdout)
+    {
+        writeAll(STDOUT_FILENO, iov, cnt);
+    }
+}
+
+void writerLoop()
+{
+    std::vector<char> arena(WRITE_BATCH * LINE_MAX_LEN);
+    struct iovec iov[WRITE_BATCH + 1];
+    char dropLine[128];
+
+    while (true)
+    {
+        int cnt = 0;
+        size_t bytes = 0;
+
+        uint64_t dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+        {
+            int n = snprintf(dropLine, sizeof(dropLine), "async log ring full, dropped %llu records\n",
+                             (unsigned long long)dropped);
+            iov[cnt].iov_base = dropLine;
+            iov[cnt].iov_len = n;
+            bytes += n;
+            cnt++;
+        }
+
+        while (cnt < (int)WRITE_BATCH)
+        {
+            LogRecord* rec = &ring[ringHead & ringMask];
+            if (rec->seq.load(std::memory_order_acquire) != ringHead + 1)
+                break;
+            char* line = &arena[cnt * LINE_MAX_LEN];
+            size_t len = formatRecord(rec, line);
+            rec->seq.store(ringHead + ringMask + 1, std::memory_order_release);
+            ringHead++;
+            iov[cnt].iov_base = line;
+            iov[cnt].iov_len = len;
+            bytes += len;
+            cnt++;
+        }
+
+        if (cnt > 0)
+        {
+            writeBatch(iov, cnt, bytes);
+            continue;
+        }
+        if (!writerRunning.load(std::memory_order_acquire))
+            break;
+
+        std::unique_lock<std::mutex> lock(writerMutex);
+        writerIdle.store(true, std::memory_order_relaxed);
+        writerCond.wait_for(lock, std::chrono::milliseconds(10));
+        writerIdle.store(false, std::memory_order_relaxed);
+    }
+}
+
+class AsyncLogDispatcher : public el::LogDispatchCallback
+{
+protected:
+    void handle(const el::LogDispatchData* data) override
+    {
+        if (data->dispatchAction() == el::base::DispatchAction::NormalLog)
+            pushRecord(data->logMessage());
+    }
+};
+
+}
+
+bool startAsyncLog(size_t capacity, AsyncLogPolicy policy)
+{
+    if (ring)
+        return true;
+
+    size_t size = 64;
+    while (size < capacity)
+        size <<= 1;
+
+    el::Logger* logger = el::Loggers::getLogger("default");
+    el::base::TypedConfigurations* tc = logger->typedConfigurations();
+    logToStdout = tc->toStandardOutput(el::Level::Info);
+    maxFileSize = tc->maxLogFileSize(el::Level::Info);
+    if (tc->toFile(el::Level::Info))
+    {
+        const std::string& filename = tc->filename(el::Level::Info);
+        logFd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (logFd < 0)
+        {
+            LOG(ERROR) << "async log: cannot open " << filename << ": " << strerror(errno);
+            return false;
+        }
+        fileSize = lseek(logFd, 0, SEEK_END);
+    }
+
+    ring = new LogRecord[size];
+    for (size_t i = 0; i < size; i++)
+    {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    ringMask = size - 1;
+    ringPolicy = policy;
+    ringTail.store(0);
+    ringHead = 0;
+
+    writerRunning.store(true);
+    writerThread = std::thread(writerLoop);
+
+    el::Helpers::installLogDispatchCallback<AsyncLogDispatcher>("AsyncLogDispatcher");
+    el::Helpers::uninstallLogDispatchCallback<el::base::DefaultLogDispatchCallback>("DefaultLogDispatchCallback");
+    LOG(INFO) << "async logging on, " << size << " records, "
+              << (policy == AsyncLogPolicy::DROP ? "drop" : "block") << " when full";
+    return true;
+}
+
+void stopAsyncLog()
+{
+    if (!ring)
+        return;
+
+    el::Helpers::installLogDispatchCallback<el::base::DefaultLogDispatchCallback>("DefaultLogDispatchCallback");
+    el::Helpers::uninstallLogDispatchCallback<AsyncLogDispatcher>("AsyncLogDispatcher");
+
+    writerRunning.store(false, std::memory_order_release);
+    writerCond.notify_one();
+    writerThread.join();
+
+    if (logFd >= 0)
+        close(logFd);
+    logFd = -1;
+    delete[] ring;
+    ring = nullptr;
+}
@@ -0,0 +1,169 @@
+#include "bitcoinrpc.h"
+#include "common.h"
+#include "easylogging++.h"
+#include <algorithm>
+#include <memory>
+
+BitcoinRpc::BitcoinRpc(Send send):
+    send_(std::move(send)), linger_(nullptr), lingerTime_{0, 0}, batchSize_(1), stopped_(true), nextId_(1),
+    calls_(0), batches_(0)
+{
+}
+
+BitcoinRpc::~BitcoinRpc()
+{
+    Stop();
+}
+
+bool BitcoinRpc::Start(struct event_base* base, size_t batchSize, int lingerMs)
+{
+    linger_ = evtimer_new(base, LingerCb, this);
+    if (!linger_)
+        return false;
+    std::lock_guard<std::mutex> lock(mtx_);
+    batchSize_ = batchSize > 0 ? batchSize : 1;
+    lingerTime_.tv_sec = lingerMs / 1000;
+    lingerTime_.tv_usec = (lingerMs % 1000) * 1000;
+    stopped_ = false;
+    return true;
+}
+
+void BitcoinRpc::Stop()
+{
+    std::vector<Pending> calls;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stopped_ = true;
+        calls.swap(pending_);
+        body_.clear();
+    }
+    if (linger_)
+        event_free(linger_);
+    linger_ = nullptr;
+    std::string reply;
+    Dispatch(calls, false, reply);
+}
+
+void BitcoinRpc::Call(const std::string& method, const std::string& params, BitcoinRpcDone done)
+{
+    std::string body;
+    std::vector<Pending> calls;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!stopped_)
+        {
+            queued = true;
+            uint64_t id = nextId_++;
+            body_ += pending_.empty() ? "[" : ",";
+            body_ += "{\"jsonrpc\":\"1.0\",\"id\":" + std::to_string(id) + ",\"method\":\"" + method + "\",\"params\":" + params + "}";
+            pending_.push_back({id, std::move(done)});
+            if (pending_.size() >= batchSize_)
+                TakeBatch(body, calls);
+            else if (pending_.size() == 1)
+                evtimer_add(linger_, &lingerTime_);
+        }
+    }
+    if (!queued)
+    {
+        std::string error = "bitcoind client stopped";
+        done(false, error);
+        return;
+    }
+    if (!calls.empty())
+        SendBatch(std::move(body), std::move(calls));
+}
+
+void BitcoinRpc::LingerCb(evutil_socket_t fd, short events, void* arg)
+{
+    BitcoinRpc* rpc = (BitcoinRpc*)arg;
+    std::string body;
+    std::vector<Pending> calls;
+    {
+        std::lock_guard<std::mutex> lock(rpc->mtx_);
+        rpc->TakeBatch(body, calls);
+    }
+    if (!calls.empty())
+        rpc->SendBatch(std::move(body), std::move(calls));
+}
+
+void BitcoinRpc::TakeBatch(std::string& body, std::vector<Pending>& calls)
+{
+    if (pending_.empty())
+        return;
+    body_ += "]";
+    body.swap(body_);
+    calls.swap(pending_);
+    body_.clear();
+}
+
+void BitcoinRpc::SendBatch(std::string body, std::vector<Pending> calls)
+{
+    calls_ += calls.size();
+    batches_++;
+    auto shared = std::make_shared<std::vector<Pending>>(std::move(calls));
+    send_(std::move(body), [shared](bool ok, std::string& reply) {
+        Dispatch(*shared, ok, reply);
+    });
+}
+
+void BitcoinRpc::Dispatch(std::vector<Pending>& calls, bool ok, std::string& reply)
+{
+    json items;
+    if (ok)
+    {
+        try
+        {
+            items = json::parse(reply);
+        }
+        catch(...)
+        {
+        }
+        if (!items.is_array())
+        {
+            LOG(ERROR) << "bitcoind: not a batch reply: " << reply.substr(0, 256);
+            ok = false;
+        }
+    }
+    if (!ok)
+    {
+        std::string error = "bitcoind request failed";
+        for (auto& call : calls)
+        {
+            std::string result = error;
+            call.done(false, result);
+        }
+        return;
+    }
+
+    // calls are in id order, the node may answer in any order
+    std::vector<bool> answered(calls.size(), false);
+    for (auto& item : items)
+    {
+        if (!item.is_object() || !item["id"].is_number_unsigned())
+            continue;
+        uint64_t id = item["id"].get<uint64_t>();
+        auto it = std::lower_bound(calls.begin(), calls.end(), id,
+                                   [](const Pending& call, uint64_t id) { return call.id < id; });
+        if (it == calls.end() || it->id != id || answered[it - calls.begin()])
+            continue;
+        answered[it - calls.begin()] = true;
+        json& error = item["error"];
+        if (!error.is_null())
+        {
+            std::string message = error.is_object() && error["message"].is_string() ?
+                                  error["message"].get<std::string>() : error.dump();
+            it->done(false, message);
+            continue;
+        }
+        std::string result = item["result"].dump();
+        it->done(true, result);
+    }
+    for (size_t i = 0; i < calls.size(); i++)
+    {
+        if (answered[i])
+            continue;
+        std::string error = "no reply from bitcoind";
+        calls[i].done(false, error);
+    }
+}
@@ -45,7 +45,7 @@ void CDBparam::getVectIntData(std::vector<int> &vectData)
     }
 }
 
-void CDBparam::setVectTxtData(const std::vector<std::__cxx11::string> &vectData)
+void CDBparam::setVectTxtData(const std::vector<std::string> &vectData)
 {
     for(unsigned int i=0;i<vectData.size();i++)
     {
@@ -53,7 +53,7 @@ void CDBparam::setVectTxtData(const std::vector<std::__cxx11::string> &vectData)
     }
 }
 
-void CDBparam::setVectTxtData(std::__cxx11::string Data)
+void CDBparam::setVectTxtData(std::string Data)
 {
     _vectTxtData.push_back(Data);
 }
@@ -1,7 +1,13 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <thread>
 #include "common.h"
+#include "hexcodec.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
 
 
 std::map<std::string,std::string> mapArgs;
@@ -29,14 +35,263 @@ signed char hexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
-bool isHex(const std::string& str)
+static bool isHexDigitsScalar(const char* p, size_t len)
 {
-    for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
+    for (size_t i = 0; i < len; i++)
     {
-        if (hexDigit(*it) < 0)
+        if (hexDigit(p[i]) < 0)
             return false;
     }
-    return (str.size() > 0) && (str.size()%2 == 0);
+    return true;
+}
+
+static const char hexChars[] = "0123456789abcdef";
+
+static void encodeHexScalar(const unsigned char* data, size_t len, char* out)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        out[2 * i] = hexChars[data[i] >> 4];
+        out[2 * i + 1] = hexChars[data[i] & 15];
+    }
+}
+
+static bool decodeHexScalar(const char* hex, unsigned char* out, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        signed char hi = hexDigit(hex[2 * i]);
+        signed char lo = hexDigit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+#ifdef HEX_X86
+
+// Nibble values of the 16 characters in v; valid gets 0xff in the lanes
+// that are hex digits. Letters are folded to lowercase with | 0x20, which
+// only maps 'A'-'F' onto 'a'-'f'.
+static inline __m128i hexNibbles(__m128i v, __m128i& valid)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(v, _mm_set1_epi8('0')), _mm_set1_epi8('9')), v);
+    __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(lower, _mm_set1_epi8('a')), _mm_set1_epi8('f')), lower);
+    valid = _mm_or_si128(digit, alpha);
+    return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                        _mm_andnot_si128(digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+// pairs of nibbles, high one first, to bytes in the low 8 lanes
+static inline __m128i packNibbles(__m128i n)
+{
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x00ff)), 4);
+    return _mm_packus_epi16(_mm_or_si128(hi, _mm_srli_epi16(n, 8)), _mm_setzero_si128());
+}
+
+// nibble values 0-15 to '0'-'9', 'a'-'f'
+static inline __m128i nibbleChars(__m128i n)
+{
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letter);
+}
+
+static void encodeHexSse2(const unsigned char* data, size_t len, char* out)
+{
+    const __m128i low = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; len - i >= 16; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+        __m128i lo = _mm_and_si128(v, low);
+        _mm_storeu_si128((__m128i*)(out + 2 * i), nibbleChars(_mm_unpacklo_epi8(hi, lo)));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), nibbleChars(_mm_unpackhi_epi8(hi, lo)));
+    }
+    encodeHexScalar(data + i, len - i, out + 2 * i);
+}
+
+static bool isHexDigitsSse2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; len - i >= 16; i += 16)
+    {
+        __m128i valid;
+        hexNibbles(_mm_loadu_si128((const __m128i*)(p + i)), valid);
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            return false;
+    }
+    return isHexDigitsScalar(p + i, len - i);
+}
+
+static bool decodeHexSse2(const char* hex, unsigned char* out, size_t len)
+{
+    size_t i = 0;
+    for (; len - i >= 8; i += 8)
+    {
+        __m128i valid;
+        __m128i n = hexNibbles(_mm_loadu_si128((const __m128i*)(hex + 2 * i)), valid);
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            return false;
+        _mm_storel_epi64((__m128i*)(out + i), packNibbles(n));
+    }
+    return decodeHexScalar(hex + 2 * i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hexNibbles256(__m256i v, __m256i& valid)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_max_epu8(v, _mm256_set1_epi8('0')), _mm256_set1_epi8('9')), v);
+    __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_max_epu8(lower, _mm256_set1_epi8('a')), _mm256_set1_epi8('f')), lower);
+    valid = _mm256_or_si256(digit, alpha);
+    return _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(v, _mm256_set1_epi8('0'))),
+                           _mm256_andnot_si256(digit, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+// Widening each byte to a 16-bit lane first keeps the output in input
+// order, which a 256-bit unpack would not across its two halves.
+__attribute__((target("avx2")))
+static void encodeHexAvx2(const unsigned char* data, size_t len, char* out)
+{
+    size_t i = 0;
+    for (; len - i >= 16; i += 16)
+    {
+        __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(data + i)));
+        // high nibble in the first byte of each lane, low nibble in the second
+        __m256i n = _mm256_or_si256(_mm256_srli_epi16(w, 4), _mm256_slli_epi16(_mm256_and_si256(w, _mm256_set1_epi16(0x0f)), 8));
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letter));
+    }
+    encodeHexSse2(data + i, len - i, out + 2 * i);
+}
+
+__attribute__((target("avx2")))
+static bool isHexDigitsAvx2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; len - i >= 32; i += 32)
+    {
+        __m256i valid;
+        hexNibbles256(_mm256_loadu_si256((const __m256i*)(p + i)), valid);
+        if ((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffff)
+            return false;
+    }
+    return isHexDigitsSse2(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static bool decodeHexAvx2(const char* hex, unsigned char* out, size_t len)
+{
+    size_t i = 0;
+    for (; len - i >= 16; i += 16)
+    {
+        __m256i valid;
+        __m256i n = hexNibbles256(_mm256_loadu_si256((const __m256i*)(hex + 2 * i)), valid);
+        if ((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffff)
+            return false;
+        __m256i hi = _mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0x00ff)), 4);
+        // packus works per 128-bit lane; the two halves land in qwords 0 and 2
+        __m256i bytes = _mm256_packus_epi16(_mm256_or_si256(hi, _mm256_srli_epi16(n, 8)), _mm256_setzero_si256());
+        bytes = _mm256_permute4x64_epi64(bytes, 0x08);
+        _mm_storeu_si128((__m128i*)(out + i), _mm256_castsi256_si128(bytes));
+    }
+    return decodeHexSse2(hex + 2 * i, out + i, len - i);
+}
+
+#endif
+
+namespace {
+
+struct HexImpl
+{
+    const char* name;
+    bool (*isHexDigits)(const char*, size_t);
+    bool (*decode)(const char*, unsigned char*, size_t);
+    void (*encode)(const unsigned char*, size_t, char*);
+};
+
+HexImpl selectHexImpl()
+{
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", isHexDigitsAvx2, decodeHexAvx2, encodeHexAvx2};
+    if (__builtin_cpu_supports("sse2"))
+        return {"sse2", isHexDigitsSse2, decodeHexSse2, encodeHexSse2};
+#endif
+    return {"scalar", isHexDigitsScalar, decodeHexScalar, encodeHexScalar};
+}
+
+const HexImpl hexImplInUse = selectHexImpl();
+
+}
+
+bool isHex(std::string_view str)
+{
+    return !str.empty() && str.size() % 2 == 0 && hexImplInUse.isHexDigits(str.data(), str.size());
+}
+
+bool decodeHex(std::string_view hex, unsigned char* out, size_t len)
+{
+    if (hex.size() != len * 2)
+        return false;
+    return hexImplInUse.decode(hex.data(), out, len);
+}
+
+void encodeHex(const unsigned char* data, size_t len, char* out)
+{
+    hexImplInUse.encode(data, len, out);
+}
+
+const char* hexImpl()
+{
+    return hexImplInUse.name;
+}
+
+bool parseAmount(std::string_view str, int64_t& satoshis)
+{
+    static const int64_t COIN = 100000000;
+    static const int64_t MAX_MONEY = 21000000 * COIN;
+    int64_t whole = 0, frac = 0;
+    size_t i = 0;
+    for (; i < str.size() && str[i] >= '0' && str[i] <= '9'; i++)
+    {
+        whole = whole * 10 + (str[i] - '0');
+        if (whole > MAX_MONEY / COIN)
+            return false;
+    }
+    // a digit on both sides of the point, as in a JSON number
+    if (i == 0)
+        return false;
+    if (i < str.size() && str[i] == '.')
+    {
+        int64_t scale = COIN;
+        size_t point = i++;
+        for (; i < str.size() && str[i] >= '0' && str[i] <= '9'; i++)
+        {
+            // no more precision than a satoshi
+            if (scale == 1)
+                return false;
+            scale /= 10;
+            frac += (str[i] - '0') * scale;
+        }
+        if (i == point + 1)
+            return false;
+    }
+    if (i != str.size())
+        return false;
+    satoshis = whole * COIN + frac;
+    return satoshis <= MAX_MONEY;
+}
+
+std::string formatAmount(int64_t satoshis)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld.%08lld", (long long)(satoshis / 100000000), (long long)(satoshis % 100000000));
+    return buf;
 }
 
 
@@ -139,3 +394,123 @@ bool isDaemon()
 {
     return mapArgs.count("daemon") && mapArgs["daemon"] == "yes";
 }
+int getNetThreads()
+{
+    int threads = mapArgs.count("netthreads") ? atoi(mapArgs["netthreads"].data()) : 0;
+    if (threads <= 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    return threads > 0 ? threads : 1;
+}
+int getWorkThreads()
+{
+    int threads = mapArgs.count("workthreads") ? atoi(mapArgs["workthreads"].data()) : 4;
+    return threads > 0 ? threads : 1;
+}
+int getWorkQueueDepth()
+{
+    int depth = mapArgs.count("workqueue") ? atoi(mapArgs["workqueue"].data()) : 256;
+    return depth > 0 ? depth : 1;
+}
+bool isAsyncLog()
+{
+    return mapArgs.count("asynclog") && mapArgs["asynclog"] == "yes";
+}
+int getLogQueueSize()
+{
+    int size = mapArgs.count("logqueue") ? atoi(mapArgs["logqueue"].data()) : 8192;
+    return size > 0 ? size : 8192;
+}
+bool isLogBlocking()
+{
+    return mapArgs.count("logpolicy") && mapArgs["logpolicy"] == "block";
+}
+static int getSeconds(const std::string& key, int def)
+{
+    int seconds = mapArgs.count(key) ? atoi(mapArgs[key].data()) : def;
+    return seconds > 0 ? seconds : def;
+}
+int getRoomWaitTimeout()
+{
+    return getSeconds("roomwaittimeout", 600);
+}
+int getRoomFundTimeout()
+{
+    return getSeconds("roomfundtimeout", 600);
+}
+int getRoomAnounceTimeout()
+{
+    return getSeconds("roomanouncetimeout", 1800);
+}
+int getRoomCompleteTTL()
+{
+    return getSeconds("roomcompletettl", 300);
+}
+int getMaxRooms()
+{
+    int rooms = mapArgs.count("maxrooms") ? atoi(mapArgs["maxrooms"].data()) : 65536;
+    return rooms > 0 ? rooms : 65536;
+}
+std::string getDataDir()
+{
+    return mapArgs.count("datadir") ? mapArgs["datadir"] : "";
+}
+int getWalSyncMs()
+{
+    int ms = mapArgs.count("walsyncms") ? atoi(mapArgs["walsyncms"].data()) : 10;
+    return ms >= 0 ? ms : 10;
+}
+int getSnapshotInterval()
+{
+    int seconds = mapArgs.count("snapshotinterval") ? atoi(mapArgs["snapshotinterval"].data()) : 300;
+    return seconds >= 0 ? seconds : 300;
+}
+int getUpstreamPoolSize()
+{
+    int size = mapArgs.count("upstreampool") ? atoi(mapArgs["upstreampool"].data()) : 8;
+    return size >= 0 ? size : 8;
+}
+int getUpstreamIdleTimeout()
+{
+    return getSeconds("upstreamidle", 60);
+}
+std::string getBitcoindUrl()
+{
+    return mapArgs.count("bitcoindurl") ? mapArgs["bitcoindurl"] : "http://127.0.0.1:8332";
+}
+std::string getBitcoindUser()
+{
+    return mapArgs.count("bitcoinduser") ? mapArgs["bitcoinduser"] : "hello";
+}
+std::string getBitcoindPassword()
+{
+    return mapArgs.count("bitcoindpassword") ? mapArgs["bitcoindpassword"] : "helloworld";
+}
+int getBitcoindBatchSize()
+{
+    int size = mapArgs.count("bitcoindbatch") ? atoi(mapArgs["bitcoindbatch"].data()) : 32;
+    return size > 0 ? size : 32;
+}
+int getBitcoindLingerMs()
+{
+    int ms = mapArgs.count("bitcoindlinger") ? atoi(mapArgs["bitcoindlinger"].data()) : 2;
+    return ms >= 0 ? ms : 2;
+}
+bool isUtxoCheck()
+{
+    return !mapArgs.count("utxocheck") || mapArgs["utxocheck"] != "no";
+}
+int getUtxoCacheSize()
+{
+    int size = mapArgs.count("utxocache") ? atoi(mapArgs["utxocache"].data()) : 65536;
+    return size >= 0 ? size : 65536;
+}
+int getUtxoNegativeTTL()
+{
+    return getSeconds("utxonegativettl", 10);
+}
+int getUtxoTipPoll()
+{
+    return getSeconds("utxotippoll", 5);
+}
@@ -0,0 +1,108 @@
+#include "curlpool.h"
+#include "easylogging++.h"
+
+CurlPool::CurlPool(const char* name):
+    name_(name), leased_(0), maxIdle_(8), idleSeconds_(60), share_(nullptr)
+{
+}
+
+CurlPool::~CurlPool()
+{
+    for (auto& idle : idle_)
+        curl_easy_cleanup(idle.curl);
+    if (share_)
+        curl_share_cleanup(share_);
+}
+
+void CurlPool::SetLimits(size_t maxIdle, int idleSeconds)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    maxIdle_ = maxIdle;
+    idleSeconds_ = idleSeconds;
+}
+
+void CurlPool::LockShare(CURL* curl, curl_lock_data data, curl_lock_access access, void* arg)
+{
+    ((CurlPool*)arg)->shareLocks_[data].lock();
+}
+
+void CurlPool::UnlockShare(CURL* curl, curl_lock_data data, void* arg)
+{
+    ((CurlPool*)arg)->shareLocks_[data].unlock();
+}
+
+bool CurlPool::InitShare()
+{
+    if (share_)
+        return true;
+    share_ = curl_share_init();
+    if (!share_)
+        return false;
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, LockShare);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, UnlockShare);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    return true;
+}
+
+void CurlPool::Configure(CURL* curl)
+{
+    curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    // cached connections older than this are not reused
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (long)idleSeconds_);
+}
+
+CURL* CurlPool::Acquire()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!idle_.empty())
+    {
+        CURL* curl = idle_.back().curl;
+        idle_.pop_back();
+        leased_++;
+        return curl;
+    }
+    if (!InitShare())
+        return nullptr;
+    CURL* curl = curl_easy_init();
+    if (!curl)
+        return nullptr;
+    Configure(curl);
+    leased_++;
+    return curl;
+}
+
+void CurlPool::Release(CURL* curl)
+{
+    // drops the last request's options, keeps the connection and caches
+    curl_easy_reset(curl);
+    std::lock_guard<std::mutex> lock(mtx_);
+    leased_--;
+    if (idle_.size() >= maxIdle_)
+    {
+        curl_easy_cleanup(curl);
+        return;
+    }
+    Configure(curl);
+    idle_.push_back({curl, std::chrono::steady_clock::now()});
+}
+
+void CurlPool::EvictIdle()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(idleSeconds_);
+    size_t expired = 0;
+    while (expired < idle_.size() && idle_[expired].since <= deadline)
+        curl_easy_cleanup(idle_[expired++].curl);
+    idle_.erase(idle_.begin(), idle_.begin() + expired);
+    if (idle_.empty() && leased_ == 0 && share_)
+    {
+        curl_share_cleanup(share_);
+        share_ = nullptr;
+    }
+    if (expired)
+        LOG(DEBUG) << name_ << " pool: closed " << expired << " idle handles, " << idle_.size() << " left";
+}
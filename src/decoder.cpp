@@ -0,0 +1,422 @@
+#include "decoder.h"
+#include "common.h"
+#include "jsonscan.h"
+#include "uint256.h"
+#include <string.h>
+
+// nested objects and arrays in skipped values
+static const int MAX_SKIP_DEPTH = 32;
+
+RequestDecoder::RequestDecoder(std::string_view body):
+    begin_(body.data()), p_(body.data()), end_(body.data() + body.size())
+{
+}
+
+bool RequestDecoder::Fail(const char* what)
+{
+    error_ = std::string(what) + " at offset " + std::to_string(p_ - begin_);
+    return false;
+}
+
+bool RequestDecoder::FailField(const RequestField& field, const char* what)
+{
+    error_ = std::string(field.name) + ": " + what;
+    return false;
+}
+
+void RequestDecoder::SkipSpace()
+{
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+        p_++;
+}
+
+bool RequestDecoder::Expect(char c)
+{
+    SkipSpace();
+    if (p_ == end_ || *p_ != c)
+        return Fail(p_ == end_ ? "unexpected end of body" : "unexpected character");
+    p_++;
+    return true;
+}
+
+static void putUtf8(std::string& out, uint32_t cp)
+{
+    if (cp < 0x80)
+        out.push_back(cp);
+    else if (cp < 0x800)
+    {
+        out.push_back(0xc0 | (cp >> 6));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        out.push_back(0xe0 | (cp >> 12));
+        out.push_back(0x80 | ((cp >> 6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        out.push_back(0xf0 | (cp >> 18));
+        out.push_back(0x80 | ((cp >> 12) & 0x3f));
+        out.push_back(0x80 | ((cp >> 6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+}
+
+static bool parseHex4(const char* p, uint32_t& v)
+{
+    v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        signed char d = hexDigit(p[i]);
+        if (d < 0)
+            return false;
+        v = (v << 4) | d;
+    }
+    return true;
+}
+
+// A string without escapes is returned as a view into the body; one with
+// escapes is unescaped into scratch_.
+bool RequestDecoder::ParseString(std::string_view& out)
+{
+    if (!Expect('"'))
+        return false;
+    const char* start = p_;
+    p_ = findStringSpecial(p_, end_);
+    if (p_ == end_)
+        return Fail("unterminated string");
+    if ((unsigned char)*p_ < 0x20)
+        return Fail("control character in string");
+    if (*p_ == '"')
+    {
+        out = std::string_view(start, p_ - start);
+        p_++;
+        return true;
+    }
+
+    // never reallocates, so earlier views into it stay valid
+    if (scratch_.capacity() == 0)
+        scratch_.reserve(end_ - begin_);
+    size_t first = scratch_.size();
+    scratch_.append(start, p_ - start);
+    while (p_ < end_ && *p_ != '"')
+    {
+        char c = *p_;
+        if ((unsigned char)c < 0x20)
+            return Fail("control character in string");
+        if (c != '\\')
+        {
+            const char* plain = findStringSpecial(p_, end_);
+            scratch_.append(p_, plain - p_);
+            p_ = plain;
+            continue;
+        }
+        if (end_ - p_ < 2)
+            return Fail("unterminated string");
+        c = p_[1];
+        p_ += 2;
+        switch (c)
+        {
+        case '"': scratch_.push_back('"'); break;
+        case '\\': scratch_.push_back('\\'); break;
+        case '/': scratch_.push_back('/'); break;
+        case 'b': scratch_.push_back('\b'); break;
+        case 'f': scratch_.push_back('\f'); break;
+        case 'n': scratch_.push_back('\n'); break;
+        case 'r': scratch_.push_back('\r'); break;
+        case 't': scratch_.push_back('\t'); break;
+        case 'u':
+        {
+            uint32_t cp;
+            if (end_ - p_ < 4 || !parseHex4(p_, cp))
+                return Fail("bad \\u escape");
+            p_ += 4;
+            if (cp >= 0xd800 && cp < 0xdc00)
+            {
+                uint32_t lo;
+                if (end_ - p_ < 6 || p_[0] != '\\' || p_[1] != 'u' || !parseHex4(p_ + 2, lo) || lo < 0xdc00 || lo > 0xdfff)
+                    return Fail("unpaired surrogate");
+                p_ += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            else if (cp >= 0xdc00 && cp < 0xe000)
+                return Fail("unpaired surrogate");
+            putUtf8(scratch_, cp);
+            break;
+        }
+        default:
+            return Fail("bad escape");
+        }
+    }
+    if (p_ == end_)
+        return Fail("unterminated string");
+    p_++;
+    out = std::string_view(scratch_.data() + first, scratch_.size() - first);
+    return true;
+}
+
+// the raw text of a number that follows the JSON grammar
+bool RequestDecoder::ParseNumber(std::string_view& out)
+{
+    SkipSpace();
+    const char* start = p_;
+    if (p_ < end_ && *p_ == '-')
+        p_++;
+    if (p_ == end_ || *p_ < '0' || *p_ > '9')
+        return Fail("bad number");
+    if (*p_ == '0')
+        p_++;
+    else
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9')
+            p_++;
+    if (p_ < end_ && *p_ == '.')
+    {
+        p_++;
+        if (p_ == end_ || *p_ < '0' || *p_ > '9')
+            return Fail("bad number");
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9')
+            p_++;
+    }
+    if (p_ < end_ && (*p_ == 'e' || *p_ == 'E'))
+    {
+        p_++;
+        if (p_ < end_ && (*p_ == '+' || *p_ == '-'))
+            p_++;
+        if (p_ == end_ || *p_ < '0' || *p_ > '9')
+            return Fail("bad number");
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9')
+            p_++;
+    }
+    out = std::string_view(start, p_ - start);
+    return true;
+}
+
+bool RequestDecoder::SkipValue()
+{
+    // closers of the open objects and arrays
+    char stack[MAX_SKIP_DEPTH];
+    int depth = 0;
+    std::string_view ignored;
+    while (true)
+    {
+        SkipSpace();
+        if (p_ == end_)
+            return Fail("unexpected end of body");
+        char c = *p_;
+        if (c == '{' || c == '[')
+        {
+            if (depth == MAX_SKIP_DEPTH)
+                return Fail("nested too deep");
+            stack[depth++] = c == '{' ? '}' : ']';
+            p_++;
+            SkipSpace();
+            if (p_ < end_ && *p_ == stack[depth - 1])
+            {
+                // empty, counts as a value
+                p_++;
+                depth--;
+            }
+            else
+            {
+                if (c == '{' && (!ParseString(ignored) || !Expect(':')))
+                    return false;
+                continue;
+            }
+        }
+        else if (c == '"')
+        {
+            if (!ParseString(ignored))
+                return false;
+        }
+        else if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            if (!ParseNumber(ignored))
+                return false;
+        }
+        else if (end_ - p_ >= 4 && memcmp(p_, "true", 4) == 0)
+            p_ += 4;
+        else if (end_ - p_ >= 5 && memcmp(p_, "false", 5) == 0)
+            p_ += 5;
+        else if (end_ - p_ >= 4 && memcmp(p_, "null", 4) == 0)
+            p_ += 4;
+        else
+            return Fail("unexpected character");
+
+        // after a value: close containers, or go on to the next member or element
+        while (depth > 0)
+        {
+            SkipSpace();
+            if (p_ == end_)
+                return Fail("unexpected end of body");
+            if (*p_ == stack[depth - 1])
+            {
+                p_++;
+                depth--;
+                continue;
+            }
+            if (*p_ != ',')
+                return Fail("expected ',' or closing bracket");
+            p_++;
+            if (stack[depth - 1] == '}' && (!ParseString(ignored) || !Expect(':')))
+                return false;
+            break;
+        }
+        if (depth == 0)
+            return true;
+    }
+}
+
+static bool parseInteger(std::string_view tok, bool allowNegative, uint64_t max, uint64_t& magnitude, bool& negative)
+{
+    negative = !tok.empty() && tok[0] == '-';
+    if (negative && !allowNegative)
+        return false;
+    magnitude = 0;
+    for (size_t i = negative; i < tok.size(); i++)
+    {
+        if (tok[i] < '0' || tok[i] > '9')
+            return false;
+        unsigned d = tok[i] - '0';
+        if (magnitude > (max - d) / 10)
+            return false;
+        magnitude = magnitude * 10 + d;
+    }
+    return true;
+}
+
+bool RequestDecoder::DecodeField(const RequestField& field, char* out)
+{
+    std::string_view tok;
+    switch (field.type)
+    {
+    case FIELD_INT:
+    case FIELD_UINT64:
+    {
+        SkipSpace();
+        if (p_ == end_ || (*p_ != '-' && (*p_ < '0' || *p_ > '9')))
+            return FailField(field, "expected an integer");
+        if (!ParseNumber(tok))
+            return false;
+        uint64_t v;
+        bool negative;
+        bool isInt = field.type == FIELD_INT;
+        if (!parseInteger(tok, isInt, isInt ? (uint64_t)INT32_MAX + 1 : UINT64_MAX, v, negative) ||
+            (isInt && !negative && v > INT32_MAX))
+            return FailField(field, "expected an integer in range");
+        if (isInt)
+        {
+            int32_t i = negative ? (int32_t)(0 - v) : (int32_t)v;
+            memcpy(out + field.offset, &i, sizeof(i));
+        }
+        else
+            memcpy(out + field.offset, &v, sizeof(v));
+        return true;
+    }
+    case FIELD_DECIMAL:
+    {
+        SkipSpace();
+        if (p_ < end_ && *p_ == '"')
+        {
+            if (!ParseString(tok))
+                return false;
+        }
+        else if (p_ < end_ && (*p_ == '-' || (*p_ >= '0' && *p_ <= '9')))
+        {
+            if (!ParseNumber(tok))
+                return false;
+        }
+        else
+            return FailField(field, "expected a decimal amount");
+        int64_t satoshis;
+        if (!parseAmount(tok, satoshis))
+            return FailField(field, "expected a decimal amount with at most 8 places");
+        memcpy(out + field.offset, &satoshis, sizeof(satoshis));
+        return true;
+    }
+    case FIELD_UINT256:
+    case FIELD_STRING:
+    case FIELD_HEX:
+        SkipSpace();
+        if (p_ == end_ || *p_ != '"')
+            return FailField(field, "expected a string");
+        if (!ParseString(tok))
+            return false;
+        if (field.type == FIELD_UINT256)
+        {
+            if (!((uint256*)(out + field.offset))->SetHex(tok))
+                return FailField(field, "expected 64 hex digits");
+            return true;
+        }
+        if (field.type == FIELD_HEX)
+        {
+            HexBytes* bytes = (HexBytes*)(out + field.offset);
+            if (tok.size() / 2 > field.maxLen)
+                return FailField(field, "too long");
+            if (tok.size() % 2 != 0 || !decodeHex(tok, bytes->data, tok.size() / 2))
+                return FailField(field, "expected hex digit pairs");
+            bytes->len = tok.size() / 2;
+            return true;
+        }
+        if (tok.size() > field.maxLen)
+            return FailField(field, "too long");
+        memcpy(out + field.offset, &tok, sizeof(tok));
+        return true;
+    }
+    return FailField(field, "unsupported type");
+}
+
+bool RequestDecoder::Decode(const RequestSchema& schema, void* out)
+{
+    uint32_t seen = 0;
+    size_t bad;
+    if (!validateUtf8(begin_, end_ - begin_, bad))
+    {
+        p_ = begin_ + bad;
+        return Fail("invalid UTF-8");
+    }
+    if (!Expect('{'))
+        return false;
+    SkipSpace();
+    if (p_ < end_ && *p_ == '}')
+        p_++;
+    else
+    {
+        while (true)
+        {
+            std::string_view key;
+            if (!ParseString(key) || !Expect(':'))
+                return false;
+            size_t i = 0;
+            while (i < schema.count && key != schema.fields[i].name)
+                i++;
+            if (i < schema.count)
+            {
+                if (!DecodeField(schema.fields[i], (char*)out))
+                    return false;
+                seen |= 1u << i;
+            }
+            else if (!SkipValue())
+                return false;
+
+            SkipSpace();
+            if (p_ < end_ && *p_ == ',')
+            {
+                p_++;
+                continue;
+            }
+            if (!Expect('}'))
+                return false;
+            break;
+        }
+    }
+    SkipSpace();
+    if (p_ != end_)
+        return Fail("trailing characters");
+    for (size_t i = 0; i < schema.count; i++)
+    {
+        if (!(seen & (1u << i)))
+            return FailField(schema.fields[i], "missing");
+    }
+    return true;
+}
@@ -0,0 +1,219 @@
+#include "jsonscan.h"
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSONSCAN_X86 1
+#endif
+
+static const char* findStringSpecialScalar(const char* p, const char* end)
+{
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+    return p;
+}
+
+// Length of the multibyte sequence at p, 0 when it is malformed or runs
+// past end. p points at a byte with the high bit set.
+static size_t utf8SequenceLength(const unsigned char* p, const unsigned char* end)
+{
+    unsigned char c = p[0];
+    size_t n;
+    uint32_t cp;
+    if (c >= 0xc2 && c <= 0xdf)
+    {
+        n = 2;
+        cp = c & 0x1f;
+    }
+    else if (c >= 0xe0 && c <= 0xef)
+    {
+        n = 3;
+        cp = c & 0x0f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4)
+    {
+        n = 4;
+        cp = c & 0x07;
+    }
+    else
+        return 0;
+    if ((size_t)(end - p) < n)
+        return 0;
+    for (size_t i = 1; i < n; i++)
+    {
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+        cp = (cp << 6) | (p[i] & 0x3f);
+    }
+    if ((n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp < 0xe000))) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff)))
+        return 0;
+    return n;
+}
+
+static bool validateUtf8Scalar(const char* s, size_t len, size_t& errorOffset)
+{
+    const unsigned char* begin = (const unsigned char*)s;
+    const unsigned char* end = begin + len;
+    const unsigned char* p = begin;
+    while (p < end)
+    {
+        if (*p < 0x80)
+        {
+            p++;
+            continue;
+        }
+        size_t n = utf8SequenceLength(p, end);
+        if (n == 0)
+        {
+            errorOffset = p - begin;
+            return false;
+        }
+        p += n;
+    }
+    return true;
+}
+
+#ifdef JSONSCAN_X86
+
+static const char* findStringSpecialSse2(const char* p, const char* end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        // unsigned v <= 0x1f exactly when min(v, 0x1f) == v
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        unsigned mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return findStringSpecialScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* findStringSpecialAvx2(const char* p, const char* end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                    _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findStringSpecialSse2(p, end);
+}
+
+// Whole blocks of ASCII are skipped on the sign bits alone; a block with a
+// high byte is validated from that byte by the scalar decoder, then the
+// vector loop resumes after the sequence.
+static bool validateUtf8Sse2(const char* s, size_t len, size_t& errorOffset)
+{
+    const unsigned char* begin = (const unsigned char*)s;
+    const unsigned char* end = begin + len;
+    const unsigned char* p = begin;
+    while (end - p >= 16)
+    {
+        unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+        if (!mask)
+        {
+            p += 16;
+            continue;
+        }
+        p += __builtin_ctz(mask);
+        size_t n = utf8SequenceLength(p, end);
+        if (n == 0)
+        {
+            errorOffset = p - begin;
+            return false;
+        }
+        p += n;
+    }
+    if (!validateUtf8Scalar((const char*)p, end - p, errorOffset))
+    {
+        errorOffset += p - begin;
+        return false;
+    }
+    return true;
+}
+
+__attribute__((target("avx2")))
+static bool validateUtf8Avx2(const char* s, size_t len, size_t& errorOffset)
+{
+    const unsigned char* begin = (const unsigned char*)s;
+    const unsigned char* end = begin + len;
+    const unsigned char* p = begin;
+    while (end - p >= 32)
+    {
+        unsigned mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p));
+        if (!mask)
+        {
+            p += 32;
+            continue;
+        }
+        p += __builtin_ctz(mask);
+        size_t n = utf8SequenceLength(p, end);
+        if (n == 0)
+        {
+            errorOffset = p - begin;
+            return false;
+        }
+        p += n;
+    }
+    if (!validateUtf8Sse2((const char*)p, end - p, errorOffset))
+    {
+        errorOffset += p - begin;
+        return false;
+    }
+    return true;
+}
+
+#endif
+
+namespace {
+
+struct JsonScanImpl
+{
+    const char* name;
+    const char* (*findStringSpecial)(const char*, const char*);
+    bool (*validateUtf8)(const char*, size_t, size_t&);
+};
+
+JsonScanImpl selectImpl()
+{
+#ifdef JSONSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", findStringSpecialAvx2, validateUtf8Avx2};
+    if (__builtin_cpu_supports("sse2"))
+        return {"sse2", findStringSpecialSse2, validateUtf8Sse2};
+#endif
+    return {"scalar", findStringSpecialScalar, validateUtf8Scalar};
+}
+
+const JsonScanImpl impl = selectImpl();
+
+}
+
+const char* findStringSpecial(const char* p, const char* end)
+{
+    return impl.findStringSpecial(p, end);
+}
+
+bool validateUtf8(const char* p, size_t len, size_t& errorOffset)
+{
+    return impl.validateUtf8(p, len, errorOffset);
+}
+
+const char* jsonScanImpl()
+{
+    return impl.name;
+}
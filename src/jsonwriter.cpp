@@ -0,0 +1,224 @@
+#include "jsonwriter.h"
+#include "jsonscan.h"
+#include "hexcodec.h"
+#include <assert.h>
+#include <charconv>
+#include <string.h>
+#include <event2/buffer.h>
+
+// space reserved in the evbuffer at a time; replies mostly fit in one
+static const size_t RESERVE_CHUNK = 4096;
+
+JsonWriter::JsonWriter(struct evbuffer* out):
+    out_(out), base_(nullptr), cur_(nullptr), end_(nullptr), depth_(0), afterKey_(false), embedded_(-1)
+{
+}
+
+JsonWriter::~JsonWriter()
+{
+    Finish();
+}
+
+void JsonWriter::Finish()
+{
+    if (!base_)
+        return;
+    struct evbuffer_iovec vec;
+    vec.iov_base = base_;
+    vec.iov_len = cur_ - base_;
+    evbuffer_commit_space(out_, &vec, 1);
+    base_ = cur_ = end_ = nullptr;
+}
+
+// room for len bytes at cur_, nullptr when the evbuffer cannot give it
+char* JsonWriter::Reserve(size_t len)
+{
+    if ((size_t)(end_ - cur_) >= len)
+        return cur_;
+    Finish();
+    struct evbuffer_iovec vec;
+    if (evbuffer_reserve_space(out_, len > RESERVE_CHUNK ? len : RESERVE_CHUNK, &vec, 1) < 1)
+        return nullptr;
+    base_ = cur_ = (char*)vec.iov_base;
+    end_ = base_ + vec.iov_len;
+    return cur_;
+}
+
+void JsonWriter::PutRaw(const char* p, size_t len)
+{
+    char* dst = Reserve(len);
+    if (!dst)
+    {
+        evbuffer_add(out_, p, len);
+        return;
+    }
+    memcpy(dst, p, len);
+    cur_ += len;
+}
+
+static size_t escapeChar(char c, char* out)
+{
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    switch (c)
+    {
+    case '"': out[1] = '"'; return 2;
+    case '\\': out[1] = '\\'; return 2;
+    case '\b': out[1] = 'b'; return 2;
+    case '\f': out[1] = 'f'; return 2;
+    case '\n': out[1] = 'n'; return 2;
+    case '\r': out[1] = 'r'; return 2;
+    case '\t': out[1] = 't'; return 2;
+    }
+    out[1] = 'u';
+    out[2] = '0';
+    out[3] = '0';
+    out[4] = hex[(unsigned char)c >> 4];
+    out[5] = hex[c & 15];
+    return 6;
+}
+
+// Inside an embedded string everything written is string content, so it
+// is escaped once more on the way out.
+void JsonWriter::Put(const char* p, size_t len)
+{
+    if (embedded_ < 0)
+    {
+        PutRaw(p, len);
+        return;
+    }
+    const char* end = p + len;
+    while (p < end)
+    {
+        const char* special = findStringSpecial(p, end);
+        PutRaw(p, special - p);
+        if (special == end)
+            break;
+        char esc[6];
+        PutRaw(esc, escapeChar(*special, esc));
+        p = special + 1;
+    }
+}
+
+void JsonWriter::PutEscaped(std::string_view s)
+{
+    const char* p = s.data();
+    const char* end = p + s.size();
+    while (p < end)
+    {
+        const char* special = findStringSpecial(p, end);
+        Put(p, special - p);
+        if (special == end)
+            break;
+        char esc[6];
+        Put(esc, escapeChar(*special, esc));
+        p = special + 1;
+    }
+}
+
+// separator before a key or a value
+void JsonWriter::Value()
+{
+    if (afterKey_)
+        afterKey_ = false;
+    else if (depth_ > 0)
+    {
+        if (!first_[depth_ - 1])
+            PutChar(',');
+        first_[depth_ - 1] = false;
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject()
+{
+    assert(depth_ < MAX_DEPTH);
+    Value();
+    PutChar('{');
+    first_[depth_++] = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject()
+{
+    assert(depth_ > 0);
+    depth_--;
+    PutChar('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key)
+{
+    Value();
+    PutChar('"');
+    PutEscaped(key);
+    Put("\":", 2);
+    afterKey_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value)
+{
+    Value();
+    PutChar('"');
+    PutEscaped(value);
+    PutChar('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value)
+{
+    char buf[24];
+    Value();
+    Put(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr - buf);
+    return *this;
+}
+
+JsonWriter& JsonWriter::UInt(uint64_t value)
+{
+    char buf[24];
+    Value();
+    Put(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr - buf);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Hex(const unsigned char* data, size_t len)
+{
+    Value();
+    PutChar('"');
+    // hex digits need no escaping, embedded or not
+    char* dst = Reserve(2 * len);
+    if (dst)
+    {
+        encodeHex(data, len, dst);
+        cur_ += 2 * len;
+    }
+    else
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            char pair[2];
+            encodeHex(data + i, 1, pair);
+            PutRaw(pair, 2);
+        }
+    }
+    PutChar('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginEmbedded()
+{
+    Value();
+    PutChar('"');
+    embedded_ = depth_;
+    // the embedded document is the value, no separator before it
+    afterKey_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndEmbedded()
+{
+    assert(embedded_ == depth_);
+    embedded_ = -1;
+    PutChar('"');
+    return *this;
+}
@@ -1,4 +1,8 @@
 #include "server.h"
+#include "asynclog.h"
+#include "metrics.h"
+#include "wal.h"
+#include "jsonscan.h"
 #include <vector>
 
 INITIALIZE_EASYLOGGINGPP
@@ -15,45 +19,109 @@ int main(int argc, char *argv[])
     el::Loggers::reconfigureAllLoggers(conf);
     LOG(INFO) << "---  start server  ---";
 
-    signal(SIGHUP, signalHandler);
-    signal(SIGTERM, signalHandler);
-    signal(SIGINT, signalHandler);
-    signal(SIGQUIT, signalHandler);
-
     readconf();
+    // before any thread makes a curl handle
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (isAsyncLog() && !startAsyncLog(getLogQueueSize(), isLogBlocking() ? AsyncLogPolicy::BLOCK : AsyncLogPolicy::DROP))
+    {
+        LOG(ERROR) << "async log start error";
+    }
     // read conf file ?
     LOG(INFO) << getListenPort();
     LOG(INFO) << getBindAddr();
     LOG(INFO) << getTimeOut();
     LOG(INFO) << isDaemon();
+    LOG(INFO) << getNetThreads();
+    LOG(INFO) << getWorkThreads();
+    LOG(INFO) << getWorkQueueDepth();
+    LOG(INFO) << getMaxRooms();
+    LOG(INFO) << getUpstreamPoolSize();
+    LOG(INFO) << "json scan: " << jsonScanImpl();
+    LOG(INFO) << "hex: " << hexImpl();
     std::string httpd_option_listen = getBindAddr();
     int httpd_option_port = getListenPort();
     int httpd_option_daemon = isDaemon();
     int httpd_option_timeout = getTimeOut();
+    int httpd_option_threads = getNetThreads();
+    int httpd_option_workthreads = getWorkThreads();
+    int httpd_option_workqueue = getWorkQueueDepth();
 
-    event_init();
-    struct evhttp *httpd;
 	registerHTTPHandler("/encodeNumber",encodeNumber);
     registerHTTPHandler("/getSecret",getSecret);
-    registerHTTPHandler("/createFundTx",createFundTx);
+    registerHTTPHandler("/createFundTx",taskHandler<createFundTx>);
     registerHTTPHandler("/getFundTx",getFundTx);
     registerHTTPHandler("/signFundTx",signFundTx);
     registerHTTPHandler("/anounceSecret",anounceSecret);
     registerHTTPHandler("/getNum",getNum);
+    // same handlers, replying with data as a nested object
+    registerHTTPHandler("/v2/encodeNumber",encodeNumber);
+    registerHTTPHandler("/v2/getSecret",getSecret);
+    registerHTTPHandler("/v2/createFundTx",taskHandler<createFundTx>);
+    registerHTTPHandler("/v2/getFundTx",getFundTx);
+    registerHTTPHandler("/v2/signFundTx",signFundTx);
+    registerHTTPHandler("/v2/anounceSecret",anounceSecret);
+    registerHTTPHandler("/v2/getNum",getNum);
+    registerHTTPHandler("/metrics",getMetrics, 1u << HTTPRequest::GET);
+
+    initRoomTable(getMaxRooms());
+    setRoomTimeouts(getRoomWaitTimeout(), getRoomFundTimeout(), getRoomAnounceTimeout(), getRoomCompleteTTL());
+    if(!getDataDir().empty() && !openRoomLog(getDataDir(), getWalSyncMs()))
+    {
+        LOG(ERROR) << "room log open error";
+        stopAsyncLog();
+        return -1;
+    }
 
-    httpd = evhttp_start(httpd_option_listen.c_str(), httpd_option_port);
-    if(!httpd)
+    if(!initHTTPServer(httpd_option_listen, httpd_option_port, httpd_option_timeout, httpd_option_threads,
+                      httpd_option_workthreads, httpd_option_workqueue))
     {
         LOG(ERROR) << "http start error";
+        stopHTTPServer();
+        stopAsyncLog();
+        return -1;
+    }
+
+    if(!startRoomTimers())
+    {
+        stopHTTPServer();
+        stopAsyncLog();
+        return -1;
+    }
+
+    BitcoinRpcConfig bitcoind;
+    bitcoind.url = getBitcoindUrl();
+    bitcoind.user = getBitcoindUser();
+    bitcoind.password = getBitcoindPassword();
+    bitcoind.batchSize = getBitcoindBatchSize();
+    bitcoind.lingerMs = getBitcoindLingerMs();
+    if(!startUpstreams(getUpstreamPoolSize(), getUpstreamIdleTimeout(), bitcoind))
+    {
+        LOG(ERROR) << "upstream start error";
+    }
+
+    if(isUtxoCheck() && !startUtxoCheck(getUtxoCacheSize(), getUtxoNegativeTTL(), getUtxoTipPoll()))
+    {
+        LOG(ERROR) << "utxo check start error";
+        stopRoomTimers();
+        stopUpstreams();
+        stopHTTPServer();
+        stopAsyncLog();
         return -1;
     }
 
-    evhttp_set_allowed_methods(httpd, EVHTTP_REQ_GET | EVHTTP_REQ_POST |  EVHTTP_REQ_HEAD | EVHTTP_REQ_PUT | EVHTTP_REQ_OPTIONS);
-    evhttp_set_timeout(httpd, httpd_option_timeout);
-    evhttp_set_gencb(httpd, httpRequestCb, nullptr);
+    if(!getDataDir().empty() && getSnapshotInterval() > 0 && !startRoomSnapshots(getSnapshotInterval()))
+    {
+        LOG(ERROR) << "room snapshots disabled";
+    }
 
-    event_dispatch();
-    evhttp_free(httpd);
+    runHTTPServer();
+    stopRoomSnapshots();
+    stopRoomTimers();
+    stopUtxoCheck();
+    stopUpstreams();
+    stopHTTPServer();
+    closeWal();
     LOG(INFO)  << "---  stop server  ---";
+    stopAsyncLog();
     return 0;
 }
@@ -0,0 +1,213 @@
+#include "metrics.h"
+#include "server.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Log-linear latency buckets in microseconds: 4 linear steps per power of
+// two, from 1us up to 2^25us (~33s). Anything slower lands in +Inf.
+const int SUB_BUCKET_BITS = 2;
+const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+const int MAX_EXPONENT = 24;
+const int LATENCY_BUCKETS = (MAX_EXPONENT - 1) * SUB_BUCKETS + SUB_BUCKETS;
+
+int latencyBucket(uint64_t us)
+{
+    if (us < (uint64_t)SUB_BUCKETS)
+        return us;
+    int e = 63 - __builtin_clzll(us);
+    if (e > MAX_EXPONENT)
+        return LATENCY_BUCKETS;
+    int m = (us >> (e - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (e - 1) * SUB_BUCKETS + m;
+}
+
+// exclusive upper bound of a bucket, in microseconds
+uint64_t latencyBucketBound(int idx)
+{
+    if (idx < SUB_BUCKETS)
+        return idx + 1;
+    int e = idx / SUB_BUCKETS + 1;
+    int m = idx % SUB_BUCKETS;
+    return (uint64_t)(SUB_BUCKETS + m + 1) << (e - SUB_BUCKET_BITS);
+}
+
+struct alignas(64) RouteCounters
+{
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> status[6];    // index = status / 100, 0 for anything odd
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint64_t> latencySum;
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS + 1];
+};
+
+struct ThreadMetrics
+{
+    explicit ThreadMetrics(size_t count):routes(new RouteCounters[count]()) {}
+
+    std::unique_ptr<RouteCounters[]> routes;
+};
+
+// only one thread writes a block, so a relaxed load/store pair is enough and
+// avoids the locked add
+inline void bump(std::atomic<uint64_t>& c, uint64_t v = 1)
+{
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+std::mutex cs_metrics;
+std::vector<ThreadMetrics*> threadMetrics;      // guarded by cs_metrics, never shrinks
+std::vector<std::string> routeNames{"other"};   // filled before the server starts
+size_t routeCount = 0;      // routeNames.size() once a thread records, then fixed
+alignas(64) std::atomic<int64_t> roomGauges[ROOM_GAUGE_COUNT];
+
+ThreadMetrics* localMetrics()
+{
+    static thread_local ThreadMetrics* local = nullptr;
+    if (!local)
+    {
+        std::lock_guard<std::mutex> lock(cs_metrics);
+        if (!routeCount)
+            routeCount = routeNames.size();
+        local = new ThreadMetrics(routeCount);
+        threadMetrics.push_back(local);
+    }
+    return local;
+}
+
+const char* const statusClassNames[6] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+
+static const HTTPHeader metricsHeaderList[] = {
+    {"Content-Type", "text/plain; version=0.0.4"},
+};
+const HTTPHeaderSet METRICS_HEADERS(metricsHeaderList);
+
+}
+
+int registerMetricsRoute(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(cs_metrics);
+    if (routeCount)
+    {
+        LOG(ERROR) << "metrics: route " << path << " registered after requests were recorded, counted as other";
+        return 0;
+    }
+    routeNames.push_back(path);
+    return routeNames.size() - 1;
+}
+
+void recordRequest(int route, int status, size_t bytesIn, size_t bytesOut, int64_t micros)
+{
+    ThreadMetrics* local = localMetrics();
+    if (route < 0 || (size_t)route >= routeCount)
+        route = 0;
+    if (micros < 0)
+        micros = 0;
+    RouteCounters& c = local->routes[route];
+    bump(c.requests);
+    int cls = status / 100;
+    bump(c.status[(cls >= 1 && cls <= 5) ? cls : 0]);
+    bump(c.bytesIn, bytesIn);
+    bump(c.bytesOut, bytesOut);
+    bump(c.latencySum, micros);
+    bump(c.latency[latencyBucket(micros)]);
+}
+
+void addRoomGauge(RoomGauge gauge, int64_t delta)
+{
+    roomGauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+
+void getMetrics(std::unique_ptr<HTTPRequest> req)
+{
+    std::vector<ThreadMetrics*> threads;
+    {
+        std::lock_guard<std::mutex> lock(cs_metrics);
+        threads = threadMetrics;
+    }
+
+    std::string out;
+    out.reserve(64 * 1024);
+    char line[256];
+
+    auto sum = [&](int route, std::atomic<uint64_t> RouteCounters::*field) {
+        uint64_t total = 0;
+        for (auto t : threads)
+            total += (t->routes[route].*field).load(std::memory_order_relaxed);
+        return total;
+    };
+
+    out += "# HELP relay_http_requests_total HTTP requests by route and status class.\n";
+    out += "# TYPE relay_http_requests_total counter\n";
+    for (size_t r = 0; r < routeNames.size(); r++)
+    {
+        for (int cls = 0; cls < 6; cls++)
+        {
+            uint64_t total = 0;
+            for (auto t : threads)
+                total += t->routes[r].status[cls].load(std::memory_order_relaxed);
+            if (!total)
+                continue;
+            snprintf(line, sizeof(line), "relay_http_requests_total{route=\"%s\",code=\"%s\"} %llu\n",
+                     routeNames[r].c_str(), statusClassNames[cls], (unsigned long long)total);
+            out += line;
+        }
+    }
+
+    out += "# HELP relay_http_request_bytes_total Request body bytes by route.\n";
+    out += "# TYPE relay_http_request_bytes_total counter\n";
+    for (size_t r = 0; r < routeNames.size(); r++)
+    {
+        snprintf(line, sizeof(line), "relay_http_request_bytes_total{route=\"%s\"} %llu\n",
+                 routeNames[r].c_str(), (unsigned long long)sum(r, &RouteCounters::bytesIn));
+        out += line;
+    }
+    out += "# HELP relay_http_response_bytes_total Response body bytes by route.\n";
+    out += "# TYPE relay_http_response_bytes_total counter\n";
+    for (size_t r = 0; r < routeNames.size(); r++)
+    {
+        snprintf(line, sizeof(line), "relay_http_response_bytes_total{route=\"%s\"} %llu\n",
+                 routeNames[r].c_str(), (unsigned long long)sum(r, &RouteCounters::bytesOut));
+        out += line;
+    }
+
+    out += "# HELP relay_http_request_duration_seconds Time from request arrival to reply, by route.\n";
+    out += "# TYPE relay_http_request_duration_seconds histogram\n";
+    for (size_t r = 0; r < routeNames.size(); r++)
+    {
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            for (auto t : threads)
+                cumulative += t->routes[r].latency[b].load(std::memory_order_relaxed);
+            snprintf(line, sizeof(line), "relay_http_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %llu\n",
+                     routeNames[r].c_str(), latencyBucketBound(b) / 1e6, (unsigned long long)cumulative);
+            out += line;
+        }
+        uint64_t count = sum(r, &RouteCounters::requests);
+        snprintf(line, sizeof(line), "relay_http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n",
+                 routeNames[r].c_str(), (unsigned long long)count);
+        out += line;
+        snprintf(line, sizeof(line), "relay_http_request_duration_seconds_sum{route=\"%s\"} %.6f\n",
+                 routeNames[r].c_str(), sum(r, &RouteCounters::latencySum) / 1e6);
+        out += line;
+        snprintf(line, sizeof(line), "relay_http_request_duration_seconds_count{route=\"%s\"} %llu\n",
+                 routeNames[r].c_str(), (unsigned long long)count);
+        out += line;
+    }
+
+    out += "# HELP relay_rooms_live Rooms whose game has not finished.\n";
+    out += "# TYPE relay_rooms_live gauge\n";
+    snprintf(line, sizeof(line), "relay_rooms_live %lld\n", (long long)roomGauges[ROOMS_LIVE].load());
+    out += line;
+    out += "# HELP relay_rooms_total Entries in the room table.\n";
+    out += "# TYPE relay_rooms_total gauge\n";
+    snprintf(line, sizeof(line), "relay_rooms_total %lld\n", (long long)roomGauges[ROOMS_TOTAL].load());
+    out += line;
+
+    req->WriteHeaders(METRICS_HEADERS);
+    req->WriteReply(HTTP_OK, std::move(out));
+}
@@ -0,0 +1,84 @@
+#include "router.h"
+
+uint64_t HTTPRouter::Hash(std::string_view path, uint64_t seed)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    for (unsigned char c : path)
+    {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+void HTTPRouter::Add(uint32_t methods, const std::string& path, HTTPRequestHandler handler, int id)
+{
+    for (auto& route : routes_)
+    {
+        if (route.path == path)
+        {
+            route.methods |= methods;
+            route.handler = handler;
+            route.id = id;
+            return;
+        }
+    }
+    routes_.push_back(Route{path, methods, handler, id});
+}
+
+bool HTTPRouter::Build()
+{
+    size_t size = 4;
+    while (size < routes_.size() * 2)
+        size <<= 1;
+
+    // the endpoint set is tiny, a collision free seed turns up within a few
+    // tries; grow the table if it somehow does not
+    for (; size <= (1u << 16); size <<= 1)
+    {
+        for (uint64_t seed = 0; seed < 4096; seed++)
+        {
+            std::vector<int> slots(size, -1);
+            bool ok = true;
+            for (size_t i = 0; i < routes_.size() && ok; i++)
+            {
+                int& slot = slots[Hash(routes_[i].path, seed) & (size - 1)];
+                ok = (slot < 0);
+                slot = i;
+            }
+            if (ok)
+            {
+                slots_.swap(slots);
+                seed_ = seed;
+                mask_ = size - 1;
+                LOG(INFO) << "route table built: " << routes_.size() << " routes, " << size << " slots, seed " << seed;
+                return true;
+            }
+        }
+    }
+
+    LOG(ERROR) << "failed to build route table";
+    return false;
+}
+
+HTTPRouter::MatchResult HTTPRouter::Match(HTTPRequest::RequestMethod method, std::string_view path, HTTPRequestHandler& handler, int& id) const
+{
+    if (slots_.empty())
+        return NOT_FOUND;
+
+    int idx = slots_[Hash(path, seed_) & mask_];
+    if (idx < 0)
+        return NOT_FOUND;
+
+    const Route& route = routes_[idx];
+    if (std::string_view(route.path) != path)
+        return NOT_FOUND;
+
+    id = route.id;
+    if (!(route.methods & MethodBit(method)))
+        return BAD_METHOD;
+
+    handler = route.handler;
+    return MATCH;
+}
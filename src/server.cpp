@@ -1,15 +1,183 @@
 
 #include "common.h"
 #include "server.h"
+#include "router.h"
+#include "metrics.h"
+#include "timerwheel.h"
+#include "slotmap.h"
+#include "room.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "decoder.h"
+#include "jsonwriter.h"
+#include "curlpool.h"
+#include "upstream.h"
+#include "utxocache.h"
 #include <sys/time.h>
 #include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <sys/wait.h>
+
+// Filled from main() and built in initHTTPServer() before the network threads
+// start, read-only afterwards, so lookups need no locking.
+static HTTPRouter httpRouter;
+
+// One event_base/evhttp pair per network thread. Every evhttp binds its own
+// listener on the same port with SO_REUSEPORT and the kernel spreads incoming
+// connections across them, so a connection stays on one thread for its life.
+struct HTTPNetThread
+{
+    struct event_base* base = nullptr;
+    struct evhttp* http = nullptr;
+    std::thread thread;
+};
+static std::vector<HTTPNetThread> netThreads;
+static std::vector<struct event*> signalEvents;
+
+// A matched request waiting for a handler thread, or a suspended Task
+// handler to continue on one.
+struct HTTPWorkItem
+{
+    HTTPWorkItem(std::unique_ptr<HTTPRequest> _req, const HTTPRequestHandler& _handler):req(std::move(_req)), handler(_handler){}
+    explicit HTTPWorkItem(std::coroutine_handle<> _task):handler(nullptr), task(_task){}
+    ~HTTPWorkItem()
+    {
+        // dropped at shutdown: the frame goes, and its request answers
+        if (task)
+            task.destroy();
+    }
+
+    void Run()
+    {
+        if (task)
+            std::exchange(task, nullptr).resume();
+        else
+            handler(std::move(req));
+    }
+
+    std::unique_ptr<HTTPRequest> req;
+    HTTPRequestHandler handler;
+    std::coroutine_handle<> task;
+};
+
+// Bounded FIFO between the network threads and the handler threads. The
+// network threads never wait on it: a full queue is reported to the caller.
+class HTTPWorkQueue
+{
+public:
+    explicit HTTPWorkQueue(size_t maxDepth):maxDepth_(maxDepth){}
+
+    bool Enqueue(std::unique_ptr<HTTPWorkItem>& item)
+    {
+        std::unique_lock<std::mutex> lock(cs_);
+        // continuations belong to requests already admitted, the depth
+        // limit is for new ones
+        if (!running_ || (!item->task && queue_.size() >= maxDepth_))
+        {
+            return false;
+        }
+        queue_.push_back(std::move(item));
+        cond_.notify_one();
+        return true;
+    }
+
+    void Run()
+    {
+        while (true)
+        {
+            std::unique_ptr<HTTPWorkItem> item;
+            {
+                std::unique_lock<std::mutex> lock(cs_);
+                while (running_ && queue_.empty())
+                    cond_.wait(lock);
+                if (!running_)
+                    break;
+                item = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            item->Run();
+        }
+    }
+
+    void Interrupt()
+    {
+        std::unique_lock<std::mutex> lock(cs_);
+        running_ = false;
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex cs_;
+    std::condition_variable cond_;
+    std::deque<std::unique_ptr<HTTPWorkItem>> queue_;
+    size_t maxDepth_;
+    bool running_ = true;
+};
+static std::unique_ptr<HTTPWorkQueue> workQueue;
+static std::vector<std::thread> workThreads;
+static int workThreadNum = 0;
+
+static const HTTPHeader corsHeaderList[] = {
+    {"Access-Control-Allow-Origin", "*"},
+    {"Access-Control-Allow-Credentials", "true"},
+    {"Access-Control-Allow-Headers", "access-control-allow-origin,Origin, X-Requested-With, Content-Type, Accept, Authorization"},
+};
+static const HTTPHeader jsonHeaderList[] = {
+    {"Content-Type", "application/json"},
+};
+const HTTPHeaderSet CORS_HEADERS(corsHeaderList);
+const HTTPHeaderSet JSON_HEADERS(jsonHeaderList);
+
+// Reply handed from a handler thread back to the loop that owns the request.
+struct HTTPPendingReply
+{
+    struct evhttp_request* req;
+    int status;
+};
+
+static void sendReplyOnLoop(struct evhttp_request* req, int nStatus)
+{
+    evhttp_send_reply(req, nStatus, nullptr, nullptr);
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001)
+    {
+       evhttp_connection* conn = evhttp_request_get_connection(req);
+       if (conn)
+       {
+           bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+           if (bev)
+           {
+               bufferevent_enable(bev, EV_READ | EV_WRITE);
+           }
+       }
+    }
+}
 
-std::vector<HTTPPathHandler> pathHandlers;
+static void sendPendingReplyCb(evutil_socket_t fd, short events, void *arg)
+{
+    std::unique_ptr<HTTPPendingReply> reply((HTTPPendingReply*)arg);
+    sendReplyOnLoop(reply->req, reply->status);
+}
 
-HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req){}
+HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req), replySent(false), route(0), startTime(std::chrono::steady_clock::now())
+{
+    evhttp_connection* conn = evhttp_request_get_connection(req);
+    base = conn ? evhttp_connection_get_base(conn) : nullptr;
+    loopThread = std::this_thread::get_id();
+}
 HTTPRequest::~HTTPRequest()
 {
-    LOG(INFO) << "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"  ;
+    if (!replySent)
+    {
+        // a handler returned without answering; don't leave the client hanging
+        LOG(ERROR) << "request finished without a reply";
+        WriteReply(HTTP_INTERNAL, "Unhandled request");
+    }
+    LOG(DEBUG) << "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"  ;
 }
 
 HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
@@ -59,30 +227,32 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
-void registerHTTPHandler(const std::string &prefix, const HTTPRequestHandler &handler)
+void registerHTTPHandler(const std::string &path, HTTPRequestHandler handler, uint32_t methods)
 {
-    LOG(INFO) << "Registering HTTP handler for " << prefix;
+    LOG(INFO) << "Registering HTTP handler for " << path;
 
-    pathHandlers.push_back(HTTPPathHandler(prefix, handler));
+    httpRouter.Add(methods, path, handler, registerMetricsRoute(path));
 }
 
-std::string HTTPRequest::GetURI()
+std::string_view HTTPRequest::GetURI()
 {
     return evhttp_request_get_uri(req);
 }
-std::string HTTPRequest::GetHeader()
-{
-    std::string urlheader;
-    struct evkeyvalq *headers;
-    struct evkeyval *header;
-    headers = evhttp_request_get_input_headers(req);
 
-    for (header = headers->tqh_first; header;header = header->next.tqe_next)
-    {
-        urlheader = urlheader + header->key + " : " + header->value + "\n";
-    }
+std::string_view HTTPRequest::GetPath()
+{
+    const char* uri = evhttp_request_get_uri(req);
+    return std::string_view(uri, strcspn(uri, "?#"));
+}
 
-    return urlheader;
+std::pair<bool, std::string_view> HTTPRequest::GetHeader(const char* hdr)
+{
+    struct evkeyvalq* headers = evhttp_request_get_input_headers(req);
+    assert(headers);
+    const char* val = evhttp_find_header(headers, hdr);
+    if (val)
+        return std::make_pair(true, std::string_view(val));
+    return std::make_pair(false, std::string_view());
 }
 
 
@@ -110,388 +280,1442 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+void HTTPRequest::WriteHeaders(const HTTPHeaderSet& headers)
+{
+    struct evkeyvalq* out = evhttp_request_get_output_headers(req);
+    assert(out);
+    for (size_t i = 0; i < headers.count; i++)
+    {
+        evhttp_add_header(out, headers.headers[i].key, headers.headers[i].value);
+    }
+}
+
+struct evbuffer* HTTPRequest::ReplyBuffer()
+{
+    assert(req);
+    return evhttp_request_get_output_buffer(req);
+}
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(req);
+    if (replySent)
+    {
+        LOG(ERROR) << "reply already sent, dropping status " << nStatus;
+        return;
+    }
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    auto req_copy = req;
+    SendReply(nStatus);
+}
 
-    evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001)
+static void releaseReplyBuffer(const void* data, size_t len, void* arg)
+{
+    delete (std::string*)arg;
+}
+
+void HTTPRequest::WriteReply(int nStatus, std::string&& strReply)
+{
+    assert(req);
+    if (replySent)
     {
-       evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-       if (conn)
-       {
-           bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-           if (bev)
-           {
-               bufferevent_enable(bev, EV_READ | EV_WRITE);
-           }
-       }
+        LOG(ERROR) << "reply already sent, dropping status " << nStatus;
+        return;
+    }
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    if (!strReply.empty())
+    {
+        // freed by libevent once the chain has been written to the socket
+        std::string* body = new std::string(std::move(strReply));
+        if (evbuffer_add_reference(evb, body->data(), body->size(), releaseReplyBuffer, body) != 0)
+        {
+            evbuffer_add(evb, body->data(), body->size());
+            delete body;
+        }
     }
+    SendReply(nStatus);
 }
 
-std::string HTTPRequest::ReadBody()
+void HTTPRequest::SendReply(int nStatus)
+{
+    replySent = true;
+
+    struct evbuffer* in = evhttp_request_get_input_buffer(req);
+    struct evbuffer* out = evhttp_request_get_output_buffer(req);
+    recordRequest(route, nStatus, in ? evbuffer_get_length(in) : 0, out ? evbuffer_get_length(out) : 0,
+                  std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+
+    // evhttp is not thread safe: only the loop that owns the connection may
+    // send, so replies from handler threads are posted back to it.
+    if (std::this_thread::get_id() == loopThread || !base)
+    {
+        sendReplyOnLoop(req, nStatus);
+        return;
+    }
+
+    static const struct timeval now = {0, 0};
+    HTTPPendingReply* reply = new HTTPPendingReply{req, nStatus};
+    if (event_base_once(base, -1, EV_TIMEOUT, sendPendingReplyCb, reply, &now) != 0)
+    {
+        LOG(ERROR) << "failed to post reply to event loop";
+        delete reply;
+    }
+}
+
+std::string_view HTTPRequest::GetBody()
 {
     struct evbuffer* buf = evhttp_request_get_input_buffer(req);
     if (!buf)
     {
         LOG(INFO) << "READ_BODY ERROR 1";
-        return "";
+        return std::string_view();
     }
 
     size_t size = evbuffer_get_length(buf);
+    if (size == 0)
+    {
+        return std::string_view();
+    }
 
+    // no copy when the body sits in a single chain, which is the common case
     const char* data = (const char*)evbuffer_pullup(buf, size);
     if (!data)
     {
-        LOG(INFO) << "READ_BODY ERROR 2   " << size;
-        return "";
+        LOG(INFO) << "READ_BODY ERROR 2   " << size;
+        return std::string_view();
+    }
+    LOG(INFO) << "READ_BODY : " << size << " bytes";
+    return std::string_view(data, size);
+}
+
+std::string HTTPRequest::ReadBody()
+{
+    return std::string(GetBody());
+}
+bool checkHash(std::string_view txid)
+{
+    return HAHS_SIZE == txid.length() && isHex(txid);
+}
+
+void httpRequestCb(struct evhttp_request *req, void *arg)
+{
+
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001)
+    {
+        evhttp_connection* conn = evhttp_request_get_connection(req);
+        if (conn)
+        {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev)
+            {
+                bufferevent_disable(bev, EV_READ);
+            }
+        }
+    }
+
+    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+
+    hreq->GetPeer();
+    LOG(INFO) << "Received a " <<  RequestMethodString(hreq->GetRequestMethod()) << " request for " <<  hreq->GetURI() << " from ";
+
+    if (hreq->GetRequestMethod() == HTTPRequest::UNKNOWN)
+    {
+        hreq->WriteReply(HTTP_BADMETHOD);
+        return;
+    }
+
+	if (hreq->GetRequestMethod() == HTTPRequest::OPTIONS)
+    {
+
+		hreq->WriteHeaders(CORS_HEADERS);
+		hreq->WriteReply(HTTP_OK);
+        return ;
+	}
+
+    hreq->WriteHeaders(CORS_HEADERS);
+
+    std::string_view path = hreq->GetPath();
+    HTTPRequestHandler handler = nullptr;
+    int route = 0;
+    HTTPRouter::MatchResult match = httpRouter.Match(hreq->GetRequestMethod(), path, handler, route);
+    hreq->SetRoute(route);
+    switch (match)
+    {
+    case HTTPRouter::MATCH:
+        {
+            LOG(INFO) << "FOUND_PATH : " << path;
+            std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), handler));
+            if (!workQueue->Enqueue(item))
+            {
+                LOG(ERROR) << "work queue depth exceeded, rejecting " << path;
+                item->req->WriteReply(HTTP_SERVUNAVAIL, "Work queue depth exceeded");
+            }
+        }
+        break;
+    case HTTPRouter::BAD_METHOD:
+        hreq->WriteReply(HTTP_BADMETHOD);
+        break;
+    case HTTPRouter::NOT_FOUND:
+        LOG(INFO) << "NOT_FOUND_PATH : " <<  path;
+        hreq->WriteReply(HTTP_NOTFOUND);
+        break;
+    }
+}
+
+
+void signalHandler(evutil_socket_t sig, short events, void *arg)
+{
+    switch (sig)
+    {
+        case SIGTERM:
+        case SIGHUP:
+        case SIGQUIT:
+        case SIGINT:
+        {
+            LOG(INFO) << "signal " << sig << " received, stopping";
+            interruptHTTPServer();
+        }
+        break;
+    }
+}
+
+static struct evconnlistener* bindReusePort(struct event_base* base, const std::string& addr, int port)
+{
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    int sslen = 0;
+    struct sockaddr_in* sin = (struct sockaddr_in*)&ss;
+    struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&ss;
+    if (evutil_inet_pton(AF_INET, addr.c_str(), &sin->sin_addr) == 1)
+    {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sslen = sizeof(*sin);
+    }
+    else if (evutil_inet_pton(AF_INET6, addr.c_str(), &sin6->sin6_addr) == 1)
+    {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        sslen = sizeof(*sin6);
+    }
+    else
+    {
+        LOG(ERROR) << "invalid bind address " << addr;
+        return nullptr;
+    }
+
+    return evconnlistener_new_bind(base, nullptr, nullptr,
+                                   LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT,
+                                   -1, (struct sockaddr*)&ss, sslen);
+}
+
+bool initHTTPServer(const std::string& addr, int port, int timeout, int threads, int workthreads, int workqueue)
+{
+    // needed for event_base_loopbreak() across threads
+    if (evthread_use_pthreads() != 0)
+    {
+        LOG(ERROR) << "evthread_use_pthreads failed";
+        return false;
+    }
+
+    if (!httpRouter.Build())
+    {
+        return false;
+    }
+
+    netThreads.resize(threads);
+    for (auto& t : netThreads)
+    {
+        t.base = event_base_new();
+        if (!t.base)
+        {
+            LOG(ERROR) << "event_base_new failed";
+            return false;
+        }
+        t.http = evhttp_new(t.base);
+        if (!t.http)
+        {
+            LOG(ERROR) << "evhttp_new failed";
+            return false;
+        }
+
+        struct evconnlistener* listener = bindReusePort(t.base, addr, port);
+        if (!listener)
+        {
+            LOG(ERROR) << "bind " << addr << ":" << port << " failed";
+            return false;
+        }
+        if (!evhttp_bind_listener(t.http, listener))
+        {
+            evconnlistener_free(listener);
+            LOG(ERROR) << "evhttp_bind_listener failed";
+            return false;
+        }
+
+        evhttp_set_allowed_methods(t.http, EVHTTP_REQ_GET | EVHTTP_REQ_POST |  EVHTTP_REQ_HEAD | EVHTTP_REQ_PUT | EVHTTP_REQ_OPTIONS);
+        evhttp_set_timeout(t.http, timeout);
+        evhttp_set_gencb(t.http, httpRequestCb, nullptr);
+    }
+
+    static const int signals[] = { SIGHUP, SIGTERM, SIGINT, SIGQUIT };
+    for (int sig : signals)
+    {
+        struct event* ev = evsignal_new(netThreads[0].base, sig, signalHandler, nullptr);
+        if (!ev || event_add(ev, nullptr) != 0)
+        {
+            LOG(ERROR) << "evsignal_new failed for " << sig;
+            return false;
+        }
+        signalEvents.push_back(ev);
+    }
+
+    workQueue.reset(new HTTPWorkQueue(workqueue));
+    workThreadNum = workthreads;
+
+    LOG(INFO) << "http server listening on " << addr << ":" << port << " with " << threads << " threads";
+    LOG(INFO) << "handler pool " << workthreads << " threads, queue depth " << workqueue;
+    return true;
+}
+
+void runHTTPServer()
+{
+    for (int i = 0; i < workThreadNum; i++)
+    {
+        workThreads.emplace_back([] { workQueue->Run(); });
+    }
+    for (auto& t : netThreads)
+    {
+        struct event_base* base = t.base;
+        t.thread = std::thread([base] { event_base_dispatch(base); });
+    }
+    for (auto& t : netThreads)
+    {
+        t.thread.join();
+    }
+}
+
+void interruptHTTPServer()
+{
+    if (workQueue)
+        workQueue->Interrupt();
+    for (auto& t : netThreads)
+    {
+        event_base_loopbreak(t.base);
+    }
+}
+
+void stopHTTPServer()
+{
+    // handler threads may still post replies to the bases, join them first
+    if (workQueue)
+        workQueue->Interrupt();
+    for (auto& t : workThreads)
+    {
+        t.join();
+    }
+    workThreads.clear();
+    workQueue.reset();
+
+    for (auto ev : signalEvents)
+    {
+        event_free(ev);
+    }
+    signalEvents.clear();
+
+    for (auto& t : netThreads)
+    {
+        if (t.http)
+            evhttp_free(t.http);
+        if (t.base)
+            event_base_free(t.base);
+    }
+    netThreads.clear();
+}
+
+void runDaemon(bool daemon)
+{
+    if (daemon) {
+        pid_t pid;
+        pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            exit(EXIT_FAILURE);
+        }
+        if (pid > 0) {
+            exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+
+// Keep-alive handles per upstream, trimmed from net thread 0's loop, which
+// also runs the non-blocking calls
+static CurlPool ipfsPool("ipfs");
+static CurlPool bitcoindPool("bitcoind");
+static struct event* upstreamEvictEvent = nullptr;
+static UpstreamClient upstreamClient;
+static BitcoinRpcConfig bitcoindConfig;
+static BitcoinRpc bitcoinRpc(curlBitcoinReqAsync);
+
+static void upstreamEvictCb(evutil_socket_t fd, short events, void *arg)
+{
+    ipfsPool.EvictIdle();
+    bitcoindPool.EvictIdle();
+}
+
+bool startUpstreams(int poolSize, int idleSeconds, const BitcoinRpcConfig& bitcoind)
+{
+    if (netThreads.empty())
+        return false;
+    bitcoindConfig = bitcoind;
+    ipfsPool.SetLimits(poolSize, idleSeconds);
+    bitcoindPool.SetLimits(poolSize, idleSeconds);
+    if (!upstreamClient.Start(netThreads[0].base, poolSize))
+    {
+        LOG(ERROR) << "upstream client start error";
+        return false;
+    }
+    if (!bitcoinRpc.Start(netThreads[0].base, bitcoind.batchSize, bitcoind.lingerMs))
+    {
+        LOG(ERROR) << "bitcoind client start error";
+        return false;
+    }
+
+    upstreamEvictEvent = event_new(netThreads[0].base, -1, EV_PERSIST, upstreamEvictCb, nullptr);
+    struct timeval tv = {std::max(idleSeconds / 2, 1), 0};
+    if (!upstreamEvictEvent || event_add(upstreamEvictEvent, &tv) != 0)
+    {
+        LOG(ERROR) << "upstream pool timer start error";
+        return false;
+    }
+    return true;
+}
+
+void stopUpstreams()
+{
+    bitcoinRpc.Stop();
+    upstreamClient.Stop();
+    if (bitcoinRpc.Calls())
+        LOG(INFO) << "bitcoind: " << bitcoinRpc.Calls() << " calls in " << bitcoinRpc.Batches() << " batches";
+    if (upstreamEvictEvent)
+    {
+        event_free(upstreamEvictEvent);
+        upstreamEvictEvent = nullptr;
+    }
+    // close everything now, while curl is still initialized
+    ipfsPool.SetLimits(0, 0);
+    ipfsPool.EvictIdle();
+    bitcoindPool.SetLimits(0, 0);
+    bitcoindPool.EvictIdle();
+}
+
+// gettxout answers behind createFundTx, cleared when the chain tip moves
+static UtxoCache utxoCache;
+static bool utxoCheck = false;
+static struct event* tipPollEvent = nullptr;
+
+static void tipPollCb(evutil_socket_t fd, short events, void *arg)
+{
+    bitcoinRpcAsync("getbestblockhash", "[]", [](bool ok, std::string &result) {
+        if (ok && utxoCache.SetTip(result))
+            LOG(DEBUG) << "chain tip " << result << ", utxo cache cleared";
+    });
+}
+
+bool startUtxoCheck(size_t cacheSize, int negativeTtl, int tipPollSeconds)
+{
+    if (netThreads.empty())
+        return false;
+    utxoCache.SetLimits(cacheSize, negativeTtl);
+    tipPollEvent = event_new(netThreads[0].base, -1, EV_PERSIST, tipPollCb, nullptr);
+    struct timeval tv = {tipPollSeconds, 0};
+    if (!tipPollEvent || event_add(tipPollEvent, &tv) != 0)
+    {
+        LOG(ERROR) << "chain tip poll start error";
+        return false;
+    }
+    tipPollCb(-1, 0, nullptr);
+    utxoCheck = true;
+    return true;
+}
+
+void stopUtxoCheck()
+{
+    utxoCheck = false;
+    if (tipPollEvent)
+    {
+        event_free(tipPollEvent);
+        tipPollEvent = nullptr;
+    }
+}
+
+// gettxout's result is null when the output is spent or unknown
+static UtxoState parseTxOut(const std::string &result, int64_t &value)
+{
+    try
+    {
+        auto txout = json::parse(result);
+        if (txout.is_null())
+            return UTXO_MISSING;
+        if (txout.is_object() && txout["value"].is_number())
+        {
+            value = llround(txout["value"].get<double>() * 100000000);
+            return UTXO_UNSPENT;
+        }
+    }
+    catch(...)
+    {
+    }
+    return UTXO_UNKNOWN;
+}
+
+// /api/v0/add answers one JSON object per line, progress first when there
+// is any; the added file's Hash is in the last one.
+static bool parseIpfsAddReply(const std::string &reply, std::string &ipfsHash)
+{
+    size_t end = reply.find_last_not_of("\r\n");
+    if (end == std::string::npos)
+        return false;
+    size_t begin = reply.find_last_of('\n', end);
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    try
+    {
+        auto jsonData = json::parse(reply.begin() + begin, reply.begin() + end + 1);
+        if (!jsonData.is_object() || !jsonData["Hash"].is_string())
+            return false;
+        ipfsHash = jsonData["Hash"].get<std::string>();
+    }
+    catch(...)
+    {
+        return false;
+    }
+    return !ipfsHash.empty();
+}
+
+static const std::string ipfsAddUrl = "http://localhost:5001/api/v0/add";
+
+bool contentToipfshash(const std::string &content, std::string &ipfsHash)
+{
+    std::string postParams = "";
+    std::string postResponseStr;
+    auto res = curl_post_req(ipfsAddUrl, postParams, content, postResponseStr);
+    if (res != CURLE_OK)
+    {
+
+        LOG(ERROR) << "curl post failed: " + std::string(curl_easy_strerror(res)) ;
+    }
+    else if (!parseIpfsAddReply(postResponseStr, ipfsHash))
+    {
+        LOG(ERROR) << "ipfs add: no Hash in reply: " << postResponseStr;
+    }
+    else
+    {
+        LOG(INFO) << "createIpfsMsg is : "<< ipfsHash;
+        return true;
+    }
+    return false;
+
+}
+
+
+size_t reqReply(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    std::string *str = (std::string*)stream;
+    (*str).append((char*)ptr, size*nmemb);
+    return size * nmemb;
+}
+
+// Request options of a bitcoind JSON-RPC call, all but where the reply
+// goes. data must outlive the transfer; the headers are the caller's.
+static struct curl_slist* setupBitcoinReq(CURL *curl, const std::string &data)
+{
+    struct curl_slist *headers = curl_slist_append(NULL, "content-type: text/plain;");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_URL, bitcoindConfig.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)data.size());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_USERNAME, bitcoindConfig.user.c_str());
+    curl_easy_setopt(curl, CURLOPT_PASSWORD, bitcoindConfig.password.c_str());
+    curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20);
+    return headers;
+}
+
+bool curlBitcoinReq(const std::string &data,std::string &response)
+{
+    CurlLease lease(bitcoindPool);
+    CURL *curl = lease.get();
+    struct curl_slist *headers = NULL;
+	CURLcode res = CURLE_FAILED_INIT;
+
+    if (curl)
+    {
+		headers = setupBitcoinReq(curl, data);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, reqReply);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+		res = curl_easy_perform(curl);
+    }
+    curl_slist_free_all(headers);
+
+    if (res != CURLE_OK)
+    {
+        LOG(ERROR) << "CURL_FAILED : " << curl_easy_strerror(res);
+        return false;
+    }
+    LOG(INFO) << "CURL_RESULT : " << response;
+
+    return true;
+}
+
+// Request options of a post, all but where the reply goes. postParams
+// must outlive the transfer; the returned mime, if any, is the caller's.
+static curl_mime* setupPostReq(CURL *curl, const std::string &url, const std::string &postParams, std::string_view upload)
+{
+    curl_mime *mime = NULL;
+    // set params
+    curl_easy_setopt(curl, CURLOPT_POST, 1); // post req
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str()); // url
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false); // if want to use https
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false); // set peer and host verify false
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20);
+
+    if (!upload.empty()) {
+        // multipart file part sent straight from memory
+        mime = curl_mime_init(curl);
+        curl_mimepart *part = curl_mime_addpart(mime);
+        curl_mime_name(part, "uploadfile");
+        curl_mime_filename(part, "msg.txt");
+        curl_mime_data(part, upload.data(), upload.size());
+        curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postParams.c_str()); // params
+    }
+    return mime;
+}
+
+CURLcode curl_post_req(const std::string &url, const std::string &postParams, std::string_view upload, std::string &response)
+{
+    // the IPFS API is the only upstream posted to here
+    CurlLease lease(ipfsPool);
+    CURL *curl = lease.get();
+    // res code
+    CURLcode res = CURLE_FAILED_INIT;
+    curl_mime *mime = NULL;
+    if (curl)
+    {
+        mime = setupPostReq(curl, url, postParams, upload);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, req_reply);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+
+        // start req
+        res = curl_easy_perform(curl);
+    }
+    curl_mime_free(mime);
+    return res;
+}
+
+void curlBitcoinReqAsync(std::string data, std::function<void(bool ok, std::string &response)> done)
+{
+    UpstreamCall* call = upstreamClient.NewCall(bitcoindPool);
+    if (!call)
+    {
+        std::string response;
+        done(false, response);
+        return;
+    }
+    call->body = std::move(data);
+    call->headers = setupBitcoinReq(call->easy, call->body);
+    upstreamClient.Perform(call, [done](CURLcode code, long status, std::string &reply) {
+        if (code != CURLE_OK)
+            LOG(ERROR) << "CURL_FAILED : " << curl_easy_strerror(code);
+        done(code == CURLE_OK, reply);
+    });
+}
+
+void contentToipfshashAsync(std::string content, std::function<void(bool ok, const std::string &ipfsHash)> done)
+{
+    static const std::string postParams = "";
+    UpstreamCall* call = upstreamClient.NewCall(ipfsPool);
+    if (!call)
+    {
+        done(false, std::string());
+        return;
+    }
+    call->body = std::move(content);
+    call->mime = setupPostReq(call->easy, ipfsAddUrl, postParams, call->body);
+    upstreamClient.Perform(call, [done](CURLcode code, long status, std::string &reply) {
+        std::string ipfsHash;
+        if (code != CURLE_OK)
+            LOG(ERROR) << "curl post failed: " + std::string(curl_easy_strerror(code));
+        else if (!parseIpfsAddReply(reply, ipfsHash))
+            LOG(ERROR) << "ipfs add: no Hash in reply: " << reply;
+        done(!ipfsHash.empty(), ipfsHash);
+    });
+}
+
+void bitcoinRpcAsync(const std::string &method, const std::string &params, BitcoinRpcDone done)
+{
+    bitcoinRpc.Call(method, params, std::move(done));
+}
+
+CallbackAwaiter<UpstreamResult> rpcCall(std::string method, std::string params)
+{
+    return CallbackAwaiter<UpstreamResult>([method = std::move(method), params = std::move(params)](std::function<void(UpstreamResult)> resume) {
+        bitcoinRpc.Call(method, params, [resume](bool ok, std::string &result) {
+            resume(UpstreamResult{ok, std::move(result)});
+        });
+    });
+}
+
+CallbackAwaiter<UpstreamResult> ipfsAdd(std::string content)
+{
+    return CallbackAwaiter<UpstreamResult>([content = std::move(content)](std::function<void(UpstreamResult)> resume) mutable {
+        contentToipfshashAsync(std::move(content), [resume](bool ok, const std::string &ipfsHash) {
+            resume(UpstreamResult{ok, ipfsHash});
+        });
+    });
+}
+
+bool WorkerAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(h));
+    if (workQueue && workQueue->Enqueue(item))
+        return true;
+    // stopping: carry on here rather than strand the handler
+    item->task = nullptr;
+    return false;
+}
+
+WorkerAwaiter resumeOnWorker()
+{
+    return WorkerAwaiter();
+}
+
+static void sleepDoneCb(evutil_socket_t fd, short events, void *arg)
+{
+    std::unique_ptr<std::function<void(bool)>> resume((std::function<void(bool)>*)arg);
+    (*resume)(true);
+}
+
+CallbackAwaiter<bool> sleepFor(std::chrono::milliseconds delay)
+{
+    return CallbackAwaiter<bool>([delay](std::function<void(bool)> resume) {
+        if (netThreads.empty())
+        {
+            resume(false);
+            return;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(delay).count();
+        struct timeval tv = {(time_t)(us / 1000000), (suseconds_t)(us % 1000000)};
+        auto* pending = new std::function<void(bool)>(std::move(resume));
+        if (event_base_once(netThreads[0].base, -1, EV_TIMEOUT, sleepDoneCb, pending, &tv) != 0)
+        {
+            std::unique_ptr<std::function<void(bool)>> failed(pending);
+            (*failed)(false);
+        }
+    });
+}
+
+// reply of the requery
+size_t req_reply(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    std::string *str = (std::string*)stream;
+    (*str).append((char*)ptr, size*nmemb);
+    return size * nmemb;
+}
+
+
+// Shared by every network thread; g_rooms, g_roomCold, g_waitingRooms,
+// g_roomTimers and the rooms they point to are only touched with cs_gameinfo
+// held.
+static SlotMap<GameInfo> g_rooms;
+static RoomCold* g_roomCold = nullptr;     // g_rooms.Capacity() entries
+
+// Room persistence: WAL and snapshots in g_dataDir. The snapshot child and
+// its timer are only touched from net thread 0's loop.
+static std::string g_dataDir;
+static struct event* snapshotEvent = nullptr;
+static pid_t snapshotPid = -1;
+static uint64_t snapshotSeq = 0;
+std::mutex cs_gameinfo;
+
+// Half-full rooms, oldest first. Intrusive, so pairing a player and dropping
+// a room are O(1) however many rooms exist.
+struct WaitingRooms
+{
+    uint32_t head = NO_ROOM;
+    uint32_t tail = NO_ROOM;
+};
+static WaitingRooms g_waitingRooms;
+
+static void pushWaitingRoom(GameInfo* room)
+{
+    uint32_t index = g_rooms.Index(room->room_id);
+    room->wait_prev = g_waitingRooms.tail;
+    room->wait_next = NO_ROOM;
+    if (g_waitingRooms.tail != NO_ROOM)
+        g_rooms.AtIndex(g_waitingRooms.tail)->wait_next = index;
+    else
+        g_waitingRooms.head = index;
+    g_waitingRooms.tail = index;
+    room->waiting = true;
+}
+
+static void removeWaitingRoom(GameInfo* room)
+{
+    if (!room->waiting)
+        return;
+    if (room->wait_prev != NO_ROOM)
+        g_rooms.AtIndex(room->wait_prev)->wait_next = room->wait_next;
+    else
+        g_waitingRooms.head = room->wait_next;
+    if (room->wait_next != NO_ROOM)
+        g_rooms.AtIndex(room->wait_next)->wait_prev = room->wait_prev;
+    else
+        g_waitingRooms.tail = room->wait_prev;
+    room->wait_prev = NO_ROOM;
+    room->wait_next = NO_ROOM;
+    room->waiting = false;
+}
+
+static GameInfo* popWaitingRoom()
+{
+    if (g_waitingRooms.head == NO_ROOM)
+        return nullptr;
+    GameInfo* room = g_rooms.AtIndex(g_waitingRooms.head);
+    removeWaitingRoom(room);
+    return room;
+}
+
+static RoomCold* roomCold(uint64_t room_id)
+{
+    return &g_roomCold[g_rooms.Index(room_id)];
+}
+
+static void releaseRoom(uint64_t room_id);
+
+void initRoomTable(int maxRooms)
+{
+    std::lock_guard<std::mutex> lock(cs_gameinfo);
+    g_rooms.Init(maxRooms);
+    free(g_roomCold);
+    g_roomCold = (RoomCold*)calloc(g_rooms.Capacity(), sizeof(RoomCold));
+}
+
+static void logRoom(RoomLogType type,uint64_t room_id,int uid);
+
+static void expireRoom(TimerNode* node)
+{
+    LOG(DEBUG) << "room " << node->data << " expired";
+    releaseRoom(node->data);
+    logRoom(LOG_ROOM_RELEASE,node->data,0);
+}
+
+// Room deadlines, one tick per second, advanced from net thread 0's loop.
+static TimerWheel g_roomTimers(expireRoom);
+static int g_roomTimeouts[ROOM_PHASE_COUNT] = {600, 600, 1800, 300};
+static struct event* roomTimerEvent = nullptr;
+static std::chrono::steady_clock::time_point roomTimerStart;
+
+static void setRoomPhase(GameInfo* room, RoomPhase phase)
+{
+    if (phase == ROOM_COMPLETE && room->phase != ROOM_COMPLETE)
+        addRoomGauge(ROOMS_LIVE, -1);
+    room->phase = phase;
+    room->timer.data = room->room_id;
+    g_roomTimers.Schedule(&room->timer, g_roomTimeouts[phase]);
+}
+
+static void roomTimerCb(evutil_socket_t fd, short events, void *arg)
+{
+    uint64_t tick = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - roomTimerStart).count();
+    std::lock_guard<std::mutex> lock(cs_gameinfo);
+    g_roomTimers.Advance(tick);
+}
+
+void setRoomTimeouts(int waitTimeout, int fundTimeout, int anounceTimeout, int completeTTL)
+{
+    g_roomTimeouts[ROOM_WAITING] = waitTimeout;
+    g_roomTimeouts[ROOM_FUNDING] = fundTimeout;
+    g_roomTimeouts[ROOM_ANOUNCING] = anounceTimeout;
+    g_roomTimeouts[ROOM_COMPLETE] = completeTTL;
+}
+
+bool startRoomTimers()
+{
+    if (netThreads.empty())
+        return false;
+    roomTimerStart = std::chrono::steady_clock::now();
+
+    roomTimerEvent = event_new(netThreads[0].base, -1, EV_PERSIST, roomTimerCb, nullptr);
+    struct timeval tv = {1, 0};
+    if (!roomTimerEvent || event_add(roomTimerEvent, &tv) != 0)
+    {
+        LOG(ERROR) << "room timer start error";
+        return false;
+    }
+    return true;
+}
+
+void stopRoomTimers()
+{
+    if (roomTimerEvent)
+    {
+        event_free(roomTimerEvent);
+        roomTimerEvent = nullptr;
+    }
+}
+
+static  void setUserInfo(UserInfo*user_info,std::string_view secret,std::string_view address)
+{
+    user_info->address.Assign(address);
+    user_info->secrect.Assign(secret);
+}
+
+// Room mutations. The handlers and WAL replay both go through these, so
+// replaying the log rebuilds exactly the rooms the handlers built.
+
+// roomid 0 takes the next free slot, anything else restores that id.
+// nullptr when the room table is full.
+static GameInfo* createRoom(uint64_t&roomid,std::string_view secret,std::string_view address)
+{
+    GameInfo* game_info = roomid ? g_rooms.Restore(roomid) : g_rooms.Insert(roomid);
+    if (!game_info)
+        return nullptr;
+    RoomCold* cold = roomCold(roomid);
+    cold->Reset();
+    setUserInfo(&cold->user_group[0],secret,address);
+    game_info->user_size =1;
+    game_info->room_id = roomid;
+    addRoomGauge(ROOMS_LIVE, 1);
+    addRoomGauge(ROOMS_TOTAL, 1);
+    pushWaitingRoom(game_info);
+    setRoomPhase(game_info, ROOM_WAITING);
+    return game_info;
+}
+
+static void joinRoom(GameInfo* game_info,std::string_view secret,std::string_view address)
+{
+    removeWaitingRoom(game_info);
+    setUserInfo(&roomCold(game_info->room_id)->user_group[1],secret,address);
+    game_info->user_size =2;
+    setRoomPhase(game_info, ROOM_FUNDING);
+}
+
+static void fundRoom(GameInfo* game_info,int uid,const uint256& txid,int64_t amount,int32_t vout)
+{
+    if(game_info->vin_size != 2)
+    {
+        game_info->vin_size++;
+        if(game_info->vin_size == 2)
+            setRoomPhase(game_info, ROOM_ANOUNCING);
+    }
+    UserInfo* user_info = &roomCold(game_info->room_id)->user_group[uid];
+    user_info->txid = txid;
+    user_info->amount = amount;
+    user_info->vout = vout;
+}
+
+static void signRoom(GameInfo* game_info,const unsigned char* tx,size_t len)
+{
+    FixedBuffer<ROOM_FUND_TX_MAX>& fund_tx = roomCold(game_info->room_id)->fund_tx;
+    memcpy(fund_tx.data, tx, len);
+    fund_tx.len = len;
+}
+
+static void anounceRoom(GameInfo* game_info,int uid,int32_t num)
+{
+    if(game_info->anounce_size !=2)
+    {
+        game_info->anounce_size++;
+        if(game_info->anounce_size == 2)
+            setRoomPhase(game_info, ROOM_COMPLETE);
+    }
+    roomCold(game_info->room_id)->user_group[uid].num = num;
+}
+
+struct RoomLogWriter
+{
+    unsigned char buf[ROOM_FUND_TX_MAX + 64];
+    size_t len = 0;
+
+    void Put(const void* p, size_t n)
+    {
+        memcpy(buf + len, p, n);
+        len += n;
+    }
+    void PutString(std::string_view s)
+    {
+        uint16_t n = s.size();
+        Put(&n, sizeof(n));
+        Put(s.data(), n);
+    }
+};
+
+struct RoomLogReader
+{
+    const unsigned char* p;
+    size_t left;
+
+    bool Get(void* out, size_t n)
+    {
+        if (left < n)
+            return false;
+        memcpy(out, p, n);
+        p += n;
+        left -= n;
+        return true;
+    }
+    bool GetString(std::string_view& s, size_t max)
+    {
+        uint16_t n;
+        if (!Get(&n, sizeof(n)) || n > max || left < n)
+            return false;
+        s = std::string_view((const char*)p, n);
+        p += n;
+        left -= n;
+        return true;
     }
-    std::string rv(data, size);
-    evbuffer_drain(buf, size);
-
-    LOG(INFO) << "READ_BODY : " << rv;
-    return rv;
-}
-bool checkHash(const std::string &txid)
-{
-    return isHex(txid) && HAHS_SIZE == txid.length();
-}
+};
 
-void httpRequestCb(struct evhttp_request *req, void *arg)
+// Records the mutation just made to room_id, from the room's current
+// state. Called with cs_gameinfo held, so records are in mutation order.
+static void logRoom(RoomLogType type,uint64_t room_id,int uid = 0)
 {
-
-    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001)
+    if (!isWalOpen())
+        return;
+    RoomLogWriter w;
+    w.Put(&room_id, sizeof(room_id));
+    if (type != LOG_ROOM_RELEASE)
     {
-        evhttp_connection* conn = evhttp_request_get_connection(req);
-        if (conn)
+        const UserInfo& user = roomCold(room_id)->user_group[uid];
+        uint8_t u = uid;
+        switch (type)
         {
-            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-            if (bev)
-            {
-                bufferevent_disable(bev, EV_READ);
-            }
+        case LOG_ROOM_CREATE:
+        case LOG_ROOM_JOIN:
+            w.PutString(user.secrect.View());
+            w.PutString(user.address.View());
+            break;
+        case LOG_ROOM_FUND:
+            w.Put(&u, sizeof(u));
+            w.Put(user.txid.data(), uint256::WIDTH);
+            w.Put(&user.amount, sizeof(user.amount));
+            w.Put(&user.vout, sizeof(user.vout));
+            break;
+        case LOG_ROOM_SIGN:
+            w.PutString(roomCold(room_id)->fund_tx.View());
+            break;
+        case LOG_ROOM_ANOUNCE:
+            w.Put(&u, sizeof(u));
+            w.Put(&user.num, sizeof(user.num));
+            break;
+        default:
+            break;
         }
     }
+    walAppend(type, w.buf, w.len);
+}
 
-    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
-
-    hreq->GetPeer();
-    LOG(INFO) << "Received a " <<  RequestMethodString(hreq->GetRequestMethod()) << " request for " <<  hreq->GetURI() << " from ";
-
-    if (hreq->GetRequestMethod() == HTTPRequest::UNKNOWN)
+static void replayRoomRecord(uint8_t type, const unsigned char* payload, size_t len)
+{
+    RoomLogReader r{payload, len};
+    uint64_t room_id;
+    if (!r.Get(&room_id, sizeof(room_id)))
+        return;
+    if (type == LOG_ROOM_CREATE)
     {
-        hreq->WriteReply(HTTP_BADMETHOD);
+        std::string_view secret, address;
+        if (r.GetString(secret, ROOM_SECRET_MAX) && r.GetString(address, ROOM_ADDRESS_MAX))
+            createRoom(room_id, secret, address);
         return;
     }
 
-	if (hreq->GetRequestMethod() == HTTPRequest::OPTIONS)
+    GameInfo* game_info = g_rooms.Get(room_id);
+    if (!game_info)
+        return;
+    uint8_t uid;
+    switch (type)
     {
-
-		hreq->WriteHeader("Access-Control-Allow-Origin", "*");
-		hreq->WriteHeader("Access-Control-Allow-Credentials", "true");
-		hreq->WriteHeader("Access-Control-Allow-Headers", "access-control-allow-origin,Origin, X-Requested-With, Content-Type, Accept, Authorization");
-		hreq->WriteReply(HTTP_OK);
-        return ;
-	}
-
-    hreq->WriteHeader("Access-Control-Allow-Origin", "*");
-    hreq->WriteHeader("Access-Control-Allow-Credentials", "true");
-    hreq->WriteHeader("Access-Control-Allow-Headers", "access-control-allow-origin,Origin, X-Requested-With, Content-Type, Accept, Authorization");
-
-    if (hreq->GetRequestMethod() != HTTPRequest::POST)
+    case LOG_ROOM_JOIN:
     {
-        hreq->WriteReply(HTTP_BADMETHOD);
-        return;
+        std::string_view secret, address;
+        if (game_info->user_size == 1 && r.GetString(secret, ROOM_SECRET_MAX) && r.GetString(address, ROOM_ADDRESS_MAX))
+            joinRoom(game_info, secret, address);
+        break;
     }
-
-    std::string strURI = hreq->GetURI();
-    std::string path;
-    std::vector<HTTPPathHandler>::const_iterator i = pathHandlers.begin();
-    std::vector<HTTPPathHandler>::const_iterator iend = pathHandlers.end();
-    for (; i != iend; ++i)
+    case LOG_ROOM_FUND:
     {
-        bool match = (strURI == i->prefix);
-        if (match)
-        {
-            path = strURI;
-            break;
-        }
+        uint256 txid;
+        int64_t amount;
+        int32_t vout;
+        if (r.Get(&uid, 1) && uid < 2 && r.Get(txid.data(), uint256::WIDTH) && r.Get(&amount, sizeof(amount)) && r.Get(&vout, sizeof(vout)))
+            fundRoom(game_info, uid, txid, amount, vout);
+        break;
     }
-
-    if(i != iend)
+    case LOG_ROOM_SIGN:
     {
-        LOG(INFO) << "FOUND_PATH : " << path;
-        i->handler(std::move(hreq));
+        std::string_view tx;
+        if (r.GetString(tx, ROOM_FUND_TX_MAX))
+            signRoom(game_info, (const unsigned char*)tx.data(), tx.size());
+        break;
     }
-    else
+    case LOG_ROOM_ANOUNCE:
     {
-        LOG(INFO) << "NOT_FOUND_PATH : " <<  strURI;
-        hreq->WriteReply(HTTP_NOTFOUND);
+        int32_t num;
+        if (r.Get(&uid, 1) && uid < 2 && r.Get(&num, sizeof(num)))
+            anounceRoom(game_info, uid, num);
+        break;
+    }
+    case LOG_ROOM_RELEASE:
+        releaseRoom(room_id);
+        break;
+    default:
+        LOG(WARNING) << "wal: unknown room record type " << (int)type;
+        break;
     }
 }
 
-
-void signalHandler(int sig)
+// a record the handlers can index without further checks
+static bool snapshotRoomValid(const SnapshotRoom& snap)
 {
-    switch (sig)
+    const size_t players = sizeof(snap.cold.user_group) / sizeof(snap.cold.user_group[0]);
+    if (snap.phase >= ROOM_PHASE_COUNT || snap.user_size > players || snap.vin_size > players ||
+        snap.anounce_size > players || snap.cold.fund_tx.len > sizeof(snap.cold.fund_tx.data))
+        return false;
+    for (const UserInfo& user : snap.cold.user_group)
     {
-        case SIGTERM:
-        case SIGHUP:
-        case SIGQUIT:
-        case SIGINT:
-        {
-            event_loopbreak();
-        }
-        break;
+        if (user.secrect.len > sizeof(user.secrect.data) || user.address.len > sizeof(user.address.data))
+            return false;
     }
+    return true;
 }
 
-void runDaemon(bool daemon)
+static bool restoreRoom(const SnapshotRoom& snap)
 {
-    if (daemon) {
-        pid_t pid;
-        pid = fork();
-        if (pid < 0) {
-            perror("fork failed");
-            exit(EXIT_FAILURE);
-        }
-        if (pid > 0) {
-            exit(EXIT_SUCCESS);
-        }
+    uint64_t roomid = snap.room_id;
+    if (!snapshotRoomValid(snap))
+    {
+        LOG(WARNING) << "snapshot: skipping bad record for room " << roomid;
+        return false;
     }
+    GameInfo* game_info = g_rooms.Restore(roomid);
+    if (!game_info)
+        return false;
+    memcpy(roomCold(roomid), &snap.cold, sizeof(RoomCold));
+    game_info->room_id = roomid;
+    game_info->user_size = snap.user_size;
+    game_info->vin_size = snap.vin_size;
+    game_info->anounce_size = snap.anounce_size;
+    game_info->phase = ROOM_WAITING;
+    addRoomGauge(ROOMS_LIVE, 1);
+    addRoomGauge(ROOMS_TOTAL, 1);
+    if (snap.phase == ROOM_WAITING)
+        pushWaitingRoom(game_info);
+    setRoomPhase(game_info, (RoomPhase)snap.phase);
+    return true;
 }
 
+// Loads the newest snapshot, returns the WAL segment to replay from
+static bool loadRoomSnapshot(const std::string& dir, uint64_t& seq)
+{
+    seq = 0;
+    if (!findSnapshot(dir, seq))
+        return true;
+    std::string path = snapshotPath(dir, seq);
+    SnapshotFile file;
+    if (!file.Open(path))
+        return false;
+    const SnapshotHeader& h = file.Header();
+    if (h.capacity > g_rooms.Capacity())
+    {
+        LOG(ERROR) << "snapshot: " << path << " holds " << h.capacity << " slots, maxrooms is " << g_rooms.Capacity();
+        return false;
+    }
+    const uint32_t* generations = file.Generations();
+    for (uint32_t i = 0; i < h.capacity; i++)
+        g_rooms.SetGeneration(i, generations[i] & 1 ? generations[i] - 1 : generations[i]);
+    const SnapshotRoom* rooms = file.Rooms();
+    uint32_t restored = 0;
+    for (uint32_t i = 0; i < h.roomCount; i++)
+        restored += restoreRoom(rooms[i]);
+    LOG(INFO) << "snapshot: loaded " << restored << " of " << h.roomCount << " rooms from " << path;
+    return true;
+}
 
-bool contentToipfshash(const std::string &content, std::string &ipfsHash)
+bool openRoomLog(const std::string& dir, int syncMs)
 {
-    char path[2048] = {0};
-    strncpy(path, getenv("HOME"), strlen(getenv("HOME")));
-    strcat(path, "/msg.txt");
-    LOG(INFO) << "path is : "<< path;
-    std::ofstream examplefile(path);
-    examplefile << content;
-    examplefile.close();
+    std::lock_guard<std::mutex> lock(cs_gameinfo);
+    uint64_t seq;
+    bool ok = loadRoomSnapshot(dir, seq) && openWal(dir, syncMs, seq, replayRoomRecord);
+    g_rooms.RebuildFreeList();
+    LOG(INFO) << "rooms after replay: " << g_rooms.Size();
+    g_dataDir = dir;
+    return ok;
+}
 
-    std::string postUrlStr = "http://localhost:5001/api/v0/add";
-    std::string postParams = "";
-    std::string filePath(path);
-    std::string postResponseStr;
-    auto res = curl_post_req(postUrlStr, postParams, filePath, postResponseStr);
-    if (res != CURLE_OK)
+// Runs in the forked child, on its copy of the table; nothing here may
+// lock or allocate.
+static bool writeRoomSnapshot(SnapshotWriter& w, uint64_t seq)
+{
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.headerSize = sizeof(h);
+    h.walSeq = seq;
+    h.capacity = g_rooms.Capacity();
+    h.roomCount = g_rooms.Size();
+    h.roomSize = sizeof(SnapshotRoom);
+    h.generationsOffset = sizeof(h);
+    uint64_t end = h.generationsOffset + (uint64_t)h.capacity * sizeof(uint32_t);
+    h.roomsOffset = (end + alignof(SnapshotRoom) - 1) / alignof(SnapshotRoom) * alignof(SnapshotRoom);
+    h.fileSize = h.roomsOffset + (uint64_t)h.roomCount * sizeof(SnapshotRoom);
+
+    if (!w.Open() || !w.Write(&h, sizeof(h)))
+        return false;
+    for (uint32_t i = 0; i < h.capacity; i++)
     {
-
-        LOG(ERROR) << "curl post failed: " + std::string(curl_easy_strerror(res)) ;
+        uint32_t generation = g_rooms.Generation(i);
+        w.Write(&generation, sizeof(generation));
     }
-    else
+    static const char zeros[alignof(SnapshotRoom)] = {};
+    w.Write(zeros, h.roomsOffset - end);
+
+    SnapshotRoom snap;
+    memset(&snap, 0, sizeof(snap));
+    for (uint32_t i = 0; i < h.capacity; i++)
     {
-        int pos = postResponseStr.find("Hash");
-        ipfsHash = postResponseStr.substr(pos + 7, pos + 27);
-        LOG(INFO) << "createIpfsMsg is : "<< ipfsHash;
-        return true;
+        if (!(g_rooms.Generation(i) & 1))
+            continue;
+        const GameInfo* game_info = g_rooms.AtIndex(i);
+        snap.room_id = game_info->room_id;
+        snap.phase = game_info->phase;
+        snap.user_size = game_info->user_size;
+        snap.vin_size = game_info->vin_size;
+        snap.anounce_size = game_info->anounce_size;
+        memcpy(&snap.cold, &g_roomCold[i], sizeof(RoomCold));
+        w.Write(&snap, sizeof(snap));
     }
-    return false;
-
+    return w.Commit();
 }
 
-
-size_t reqReply(void *ptr, size_t size, size_t nmemb, void *stream)
+static void reapSnapshot(bool wait)
 {
-    std::string *str = (std::string*)stream;
-    (*str).append((char*)ptr, size*nmemb);
-    return size * nmemb;
+    int status;
+    if (snapshotPid <= 0 || waitpid(snapshotPid, &status, wait ? 0 : WNOHANG) == 0)
+        return;
+    snapshotPid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        LOG(ERROR) << "snapshot " << snapshotSeq << " failed";
+        return;
+    }
+    LOG(INFO) << "snapshot " << snapshotSeq << " written";
+    pruneWal(snapshotSeq);
+    pruneSnapshots(g_dataDir, snapshotSeq);
 }
 
-bool curlBitcoinReq(const std::string &data,std::string &response)
+static void snapshotTimerCb(evutil_socket_t fd, short events, void *arg)
 {
-    CURL *curl = curl_easy_init();
-    struct curl_slist *headers = NULL;
-	CURLcode res;
-
-	const std::string url = "http://127.0.0.1:8332";
+    reapSnapshot(false);
+    if (snapshotPid > 0)
+        return;
 
-    if (curl)
+    SnapshotWriter* writer;
     {
-		headers = curl_slist_append(headers, "content-type: text/plain;");
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)data.size());
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
-
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, reqReply);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-
-		curl_easy_setopt(curl, CURLOPT_USERPWD, "hello:helloworld");
-		curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
-		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20);
-		res = curl_easy_perform(curl);
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        uint64_t seq = rotateWal();
+        if (!seq)
+            return;
+        // built before the fork, the child must not allocate
+        writer = new SnapshotWriter(g_dataDir, seq);
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(writeRoomSnapshot(*writer, seq) ? 0 : 1);
+        snapshotPid = pid;
+        snapshotSeq = seq;
     }
-    curl_easy_cleanup(curl);
+    delete writer;
+    if (snapshotPid < 0)
+        LOG(ERROR) << "snapshot fork error: " << strerror(errno);
+}
 
-    if (res != CURLE_OK)
+bool startRoomSnapshots(int interval)
+{
+    if (netThreads.empty() || g_dataDir.empty() || interval <= 0)
+        return false;
+    snapshotEvent = event_new(netThreads[0].base, -1, EV_PERSIST, snapshotTimerCb, nullptr);
+    struct timeval tv = {interval, 0};
+    if (!snapshotEvent || event_add(snapshotEvent, &tv) != 0)
     {
-        LOG(ERROR) << "CURL_FAILED : " << curl_easy_strerror(res);
+        LOG(ERROR) << "snapshot timer start error";
         return false;
     }
-    LOG(INFO) << "CURL_RESULT : " << response;
-
     return true;
 }
 
-CURLcode curl_post_req(const std::string &url, const std::string &postParams, std::string &filepath, std::string &response)
+void stopRoomSnapshots()
 {
-    // init curl
-    CURL *curl = curl_easy_init();
-    // res code
-    CURLcode res;
-    if (curl)
+    if (snapshotEvent)
     {
-        // set params
-        curl_easy_setopt(curl, CURLOPT_POST, 1); // post req
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str()); // url
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postParams.c_str()); // params
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false); // if want to use https
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false); // set peer and host verify false
-        curl_easy_setopt(curl, CURLOPT_READFUNCTION, NULL);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, req_reply);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20);
-
-        if (!filepath.empty()) {
-            struct curl_httppost* post = NULL;
-            struct curl_httppost* last = NULL;
-            curl_formadd(&post, &last, CURLFORM_COPYNAME, "uploadfile", CURLFORM_FILE, filepath.c_str(), CURLFORM_END);
-            curl_easy_setopt(curl, CURLOPT_HTTPPOST, post);
-        }
-
-        // start req
-        res = curl_easy_perform(curl);
+        event_free(snapshotEvent);
+        snapshotEvent = nullptr;
     }
-    // release curl
-    curl_easy_cleanup(curl);
-    return res;
+    reapSnapshot(true);
 }
 
-// reply of the requery
-size_t req_reply(void *ptr, size_t size, size_t nmemb, void *stream)
+// Request bodies, one struct and field list per shape. The string views
+// point into the request body or the decoder, so both outlive the struct.
+struct RoomParams
 {
-    std::string *str = (std::string*)stream;
-    (*str).append((char*)ptr, size*nmemb);
-    return size * nmemb;
-}
+    uint64_t roomid;
+};
+static const RequestField roomFields[] = {
+    {"roomid", FIELD_UINT64, offsetof(RoomParams, roomid), 0},
+};
 
+struct EncodeNumberParams
+{
+    std::string_view secret;
+    std::string_view address;
+};
+static const RequestField encodeNumberFields[] = {
+    {"secret", FIELD_STRING, offsetof(EncodeNumberParams, secret), ROOM_SECRET_MAX},
+    {"address", FIELD_STRING, offsetof(EncodeNumberParams, address), ROOM_ADDRESS_MAX},
+};
 
-static int g_roomId =1;
-struct UserInfo
+struct CreateFundTxParams
 {
-	int uid;
-	std::string secrect;
-	std::string address;
-    std::string txid;
-    int vout;
-    std::string amount;
-	int num;
+    uint64_t roomid;
+    int32_t uid;
+    uint256 txid;
+    int64_t amount;
+    int32_t vout;
 };
-struct GameInfo
-{	
-    std::vector<UserInfo*>  user_group;
-	int user_size;
-    int vin_size;
-    int anounce_size;
-    std::string fund_tx;
-	GameInfo()
-	{
-		user_size=0;
-        vin_size=0;
-        anounce_size=0;
-	}
+static const RequestField createFundTxFields[] = {
+    {"roomid", FIELD_UINT64, offsetof(CreateFundTxParams, roomid), 0},
+    {"uid", FIELD_INT, offsetof(CreateFundTxParams, uid), 0},
+    {"txid", FIELD_UINT256, offsetof(CreateFundTxParams, txid), 0},
+    {"amount", FIELD_DECIMAL, offsetof(CreateFundTxParams, amount), 0},
+    {"vout", FIELD_INT, offsetof(CreateFundTxParams, vout), 0},
+};
+
+struct SignFundTxParams
+{
+    uint64_t roomid;
+    HexBytes tx;
+};
+static const RequestField signFundTxFields[] = {
+    {"roomid", FIELD_UINT64, offsetof(SignFundTxParams, roomid), 0},
+    {"hex", FIELD_HEX, offsetof(SignFundTxParams, tx), ROOM_FUND_TX_MAX},
 };
 
-std::map<int ,GameInfo*>  g_mapGameInfo;
+struct AnounceSecretParams
+{
+    uint64_t roomid;
+    int32_t uid;
+    int32_t num;
+};
+static const RequestField anounceSecretFields[] = {
+    {"roomid", FIELD_UINT64, offsetof(AnounceSecretParams, roomid), 0},
+    {"uid", FIELD_INT, offsetof(AnounceSecretParams, uid), 0},
+    {"num", FIELD_INT, offsetof(AnounceSecretParams, num), 0},
+};
 
-static  void setUserInfo(UserInfo*user_info,int uid,const std::string &secret,const std::string &address)
+// decodes the body into params, or answers 400 saying what is wrong
+static bool decodeParams(HTTPRequest* req, RequestDecoder& decoder, const RequestSchema& schema, void* params)
 {
-    user_info->address = address;
-    user_info->secrect = secret;
-    user_info->uid = uid;
+    if (decoder.Decode(schema, params))
+        return true;
+    LOG(DEBUG) << "bad request body: " << decoder.Error();
+    req->WriteReply(HTTP_BADREQUEST, decoder.Error());
+    return false;
 }
 
-static void createRoom(int&uid,int&roomid,const std::string &secret,const std::string &address)
+// Routes under /v2/ get the reply data as a nested object; the original
+// routes get it as JSON text inside a string.
+static bool isV2(HTTPRequest* req)
 {
-    uid = 0;
-    GameInfo* game_info = new GameInfo();
-    UserInfo* user_info = new UserInfo();
-    setUserInfo(user_info,uid,secret,address);
-    game_info->user_group.push_back(user_info);
-    game_info->user_size =1;
-    g_mapGameInfo[g_roomId] = game_info;
-    roomid = g_roomId;
-    g_roomId++;
+    return req->GetPath().substr(0, 4) == "/v2/";
+}
+
+// opens {"code":..,"data": for data the caller writes as one object
+static void beginDataReply(JsonWriter& w, int ret_code, bool v2)
+{
+    w.BeginObject().Key("code").Int(ret_code ? RESPONSE_TPYE::OK : RESPONSE_TPYE::ERROR).Key("data");
+    if (!v2)
+        w.BeginEmbedded();
+}
+
+static void endDataReply(JsonWriter& w, bool v2)
+{
+    if (!v2)
+        w.EndEmbedded();
+    w.EndObject();
+    w.Finish();
+}
+
+// {"code":..,"data":"message"}, the same in both versions
+static void writeMessageReply(HTTPRequest* req, int ret_code, std::string_view msg)
+{
+    req->WriteHeaders(JSON_HEADERS);
+    JsonWriter w(req->ReplyBuffer());
+    w.BeginObject().Key("code").Int(ret_code ? RESPONSE_TPYE::OK : RESPONSE_TPYE::ERROR).Key("data").String(msg).EndObject();
+    w.Finish();
+    req->WriteReply(HTTP_OK);
 }
 
 void encodeNumber(std::unique_ptr<HTTPRequest> req)
 {
     try
     {
-        std::string post_data = req->ReadBody();
-		std::cout << "encodeNumber receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
-
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " encodeNumber  params error\n ";
-            throw;
-        }
+        std::string_view post_data = req->GetBody();
+		LOG(DEBUG) << "encodeNumber receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        EncodeNumberParams params;
+        if (!decodeParams(req.get(), decoder, encodeNumberFields, &params))
+            return;
 		
-       	std::string secret = jsonData["secret"].get<std::string>();
-        std::cout << " secret is:  " << secret  <<std::endl;
-        std::string address = jsonData["address"].get<std::string>();
-		std::cout << "address is: " << address << std::endl;
+       	std::string_view secret = params.secret;
+        LOG(DEBUG) << " secret is:  " << secret;
+        std::string_view address = params.address;
+		LOG(DEBUG) << "address is: " << address;
 		
-        int roomid =-1;
+        uint64_t roomid = 0;
         int uid = -1;
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.begin();
-        if(iter == g_mapGameInfo.end())
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = popWaitingRoom();
+        if(game_info)
+        {
+            uid =1 ;
+            roomid = game_info->room_id;
+            joinRoom(game_info,secret,address);
+            logRoom(LOG_ROOM_JOIN,roomid,uid);
+        }
+        else if (createRoom(roomid,secret,address))
         {
-            createRoom(uid,roomid,secret,address);
+            uid = 0;
+            logRoom(LOG_ROOM_CREATE,roomid,uid);
         }
         else
         {
-            bool has_match = false;
-            for(;iter != g_mapGameInfo.end();++iter)
-            {
-                if(iter->second->user_size == 1)
-                {
-                    uid =1 ;
-                    UserInfo* user_info = new UserInfo();
-                    setUserInfo(user_info,uid,secret,address);
-                    iter->second->user_group.push_back(user_info);
-                    iter->second->user_size =2;
-                    roomid = iter->first;
-                    has_match =true;
-                    break;
-                }
-            }
-
-            if (!has_match)
-            {
-                createRoom(uid,roomid,secret,address);
-            }
+            LOG(WARNING) << "encodeNumber: room table full";
+            req->WriteReply(HTTP_SERVUNAVAIL, "Room table full");
+            return;
         }
 
-        json response = json::object();
-        response["roomid"] = roomid;
-        response["uid"] = uid;
-		
-        std::string result = response.dump() ;
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
+        req->WriteHeaders(JSON_HEADERS);
+        JsonWriter w(req->ReplyBuffer());
+        w.BeginObject().Key("roomid").UInt(roomid).Key("uid").Int(uid).EndObject();
+        w.Finish();
+        req->WriteReply(HTTP_OK);
         return;
 
     }
@@ -510,37 +1734,42 @@ void getSecret(std::unique_ptr<HTTPRequest> req)
     try
     {
 	int ret_code=0;
-        std::string post_data = req->ReadBody();
-        std::cout << "getSecret receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
-
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " getSecret  params error\n ";
-            throw;
-        }
+        std::string_view post_data = req->GetBody();
+        LOG(DEBUG) << "getSecret receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        RoomParams params;
+        if (!decodeParams(req.get(), decoder, roomFields, &params))
+            return;
 
         std::string strReply;
-        int  roomid = jsonData["roomid"].get<int> ();
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
-        if(iter != g_mapGameInfo.end())
+        uint64_t roomid = params.roomid;
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = g_rooms.Get(roomid);
+        if (game_info)
         {
-            if( g_mapGameInfo[roomid]->user_size == 1)
+            if( game_info->user_size == 1)
             {
                 strReply =  "Maybe no user player with you!";
 		ret_code=1;
             }
             else
             {
-                json response = json::object();
+                bool v2 = isV2(req.get());
                 std::string reply_secret="secret";
                 std::string reply_addres="address";
-                for(int i =0;i<g_mapGameInfo[roomid]->user_group.size();i++)
-                {
-                   response[reply_secret + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->secrect;
-                   response[reply_addres + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->address;
-                }
-                strReply = response.dump();
+                RoomCold* cold = roomCold(roomid);
+                req->WriteHeaders(JSON_HEADERS);
+                JsonWriter w(req->ReplyBuffer());
+                beginDataReply(w, ret_code, v2);
+                w.BeginObject();
+                for(int i =0;i<game_info->user_size;i++)
+                   w.Key(reply_addres + std::to_string(i)).String(cold->user_group[i].address.View());
+                for(int i =0;i<game_info->user_size;i++)
+                   w.Key(reply_secret + std::to_string(i)).String(cold->user_group[i].secrect.View());
+                w.EndObject();
+                endDataReply(w, v2);
+                req->WriteReply(HTTP_OK);
+                return;
             }
         }
         else
@@ -550,9 +1779,7 @@ void getSecret(std::unique_ptr<HTTPRequest> req)
 
         }
 
-        std::string result = makeReplyMsg(ret_code,strReply);
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
+        writeMessageReply(req.get(),ret_code,strReply);
         return;
 
     }
@@ -564,53 +1791,102 @@ void getSecret(std::unique_ptr<HTTPRequest> req)
     req->WriteReply(HTTP_INTERNAL,ERROR_REQUEST);
 }
 
-void createFundTx(std::unique_ptr<HTTPRequest> req)
+// The room and seat createFundTx funds, or nullptr with the reply to send.
+// With cs_gameinfo held.
+static GameInfo* fundTarget(uint64_t roomid, int uid, int& ret_code, std::string& strReply)
 {
-    try
+    GameInfo* game_info = g_rooms.Get(roomid);
+    if (!game_info)
     {
-        std::string post_data = req->ReadBody();
-        std::cout << "createFundTx receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
+        ret_code = 2;
+        strReply = "No such roomid!";
+        return nullptr;
+    }
+    if (game_info->user_size != 2)
+    {
+        ret_code = 1;
+        strReply = "No one palys with you!";
+        return nullptr;
+    }
+    if (uid < 0 || uid >= game_info->user_size)
+    {
+        ret_code = 2;
+        strReply = "No such uid!";
+        return nullptr;
+    }
+    return game_info;
+}
 
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " createFundTx  params error\n ";
-            throw;
-        }
-        int roomid = jsonData["roomid"].get<int>();
-        int uid = jsonData["uid"].get<int>();
-        std::string txid = jsonData["txid"].get<std::string>();
-        std::string amount = jsonData["amount"].get<std::string>();
-        int vout = jsonData["vout"].get<int>();
+Task createFundTx(std::unique_ptr<HTTPRequest> req)
+{
+    try
+    {
+        std::string_view post_data = req->GetBody();
+        LOG(DEBUG) << "createFundTx receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        CreateFundTxParams params;
+        if (!decodeParams(req.get(), decoder, createFundTxFields, &params))
+            co_return;
+        uint64_t roomid = params.roomid;
+        int uid = params.uid;
 
 	int ret_code = 0;
         std::string strReply;
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
-        if ( iter != g_mapGameInfo.end())
+        if (utxoCheck)
         {
-            if(iter->second->user_size != 2)
+            // a bad room or uid costs no trip to the node
             {
-		ret_code =1;
-                strReply = "No one palys with you!";
+                std::lock_guard<std::mutex> lock(cs_gameinfo);
+                if (!fundTarget(roomid, uid, ret_code, strReply))
+                {
+                    writeMessageReply(req.get(), ret_code, strReply);
+                    co_return;
+                }
             }
-            else
+
+            // the output must exist, unspent, and hold the amount claimed
+            int64_t value = 0;
+            uint64_t epoch = 0;
+            UtxoState state = params.vout < 0 ? UTXO_MISSING : utxoCache.Lookup(params.txid, params.vout, value, epoch);
+            if (state == UTXO_UNKNOWN)
             {
-                strReply ="OK";
-                if(g_mapGameInfo[roomid]->vin_size != 2)
-                    g_mapGameInfo[roomid]->vin_size++;
-                g_mapGameInfo[roomid]->user_group[uid]->txid = txid;
-                g_mapGameInfo[roomid]->user_group[uid]->amount = amount;
-                g_mapGameInfo[roomid]->user_group[uid]->vout = vout;
+                UpstreamResult txout = co_await rpcCall("gettxout", "[\"" + params.txid.GetHex() + "\"," + std::to_string(params.vout) + ",true]");
+                // off net thread 0, which drives every upstream and timer,
+                // before taking the room lock and logging
+                co_await resumeOnWorker();
+                if (txout.ok)
+                    state = parseTxOut(txout.data, value);
+                if (state == UTXO_UNKNOWN)
+                {
+                    LOG(ERROR) << "createFundTx: gettxout failed: " << txout.data;
+                    writeMessageReply(req.get(), 3, "Cannot check the funding output!");
+                    co_return;
+                }
+                utxoCache.Put(params.txid, params.vout, state, value, epoch);
+            }
+            if (state == UTXO_MISSING)
+            {
+                writeMessageReply(req.get(), 3, "No such unspent output!");
+                co_return;
+            }
+            if (value != params.amount)
+            {
+                writeMessageReply(req.get(), 3, "Amount does not match the output!");
+                co_return;
             }
         }
-        else
+
+        // checked again, the room may have moved on during the lookup
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = fundTarget(roomid, uid, ret_code, strReply);
+        if (game_info)
         {
-	    ret_code=2;
-            strReply = "No such roomid!";
+            strReply ="OK";
+            fundRoom(game_info,uid,params.txid,params.amount,params.vout);
+            logRoom(LOG_ROOM_FUND,roomid,uid);
         }
-        std::string result = makeReplyMsg(ret_code,strReply);
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
+        writeMessageReply(req.get(),ret_code,strReply);
+        co_return;
     }
     catch(...)
     {
@@ -624,67 +1900,79 @@ void getFundTx(std::unique_ptr<HTTPRequest> req)
 {
     try
     {
-        std::string post_data = req->ReadBody();
-        std::cout << "getFundTx receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
-
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " getFundTx  params error\n ";
-            throw;
-        }
+        std::string_view post_data = req->GetBody();
+        LOG(DEBUG) << "getFundTx receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        RoomParams params;
+        if (!decodeParams(req.get(), decoder, roomFields, &params))
+            return;
 	int ret_code=0;
-        int roomid = jsonData["roomid"].get<int>();
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
+        uint64_t roomid = params.roomid;
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = g_rooms.Get(roomid);
         std::string strReply;
-        if ( iter != g_mapGameInfo.end())
+        if (game_info)
         {
-            if(iter->second->vin_size != 2)
+            if(game_info->vin_size != 2)
             {
 		ret_code=1;
                 strReply = "No one palys agree you!";
             }
             else
             {
-                json response = json::object();
+                bool v2 = isV2(req.get());
                 std::string txid="txid";
                 std::string vout="vout";
                 std::string amount = "amount";
 		
-                for(int i =0;i<g_mapGameInfo[roomid]->user_group.size();i++)
-                {
-                   response[txid + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->txid;
-                   response[amount + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->amount;
-                   response[vout + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->vout;
-                }
-		double amount0 = atof(g_mapGameInfo[roomid]->user_group[0]->amount.c_str());
-		double amount1 = atof(g_mapGameInfo[roomid]->user_group[1]->amount.c_str());
+                RoomCold* cold = roomCold(roomid);
+		double amount0 = cold->user_group[0].amount / 1e8;
+		double amount1 = cold->user_group[1].amount / 1e8;
                 double  changle = amount0 - amount1;
+                std::string_view changeAddress;
+                std::string change;
+                std::string scriptAmount;
                 if( changle == 0.0)
                 {
-                    response["changeAddress"] = "";
-                    response["change"] = "";
-            response["scriptAmount"] = std::to_string(amount0*2 - 0.01);
+            scriptAmount = std::to_string(amount0*2 - 0.01);
 		    
                 }
                 else if( changle > 0.0 )
                 {
-                    response["changeAddress"] = g_mapGameInfo[roomid]->user_group[0]->address;
-                    response["change"] = std::to_string(changle);
-            response["scriptAmount"] = std::to_string(amount1*2 - 0.01);
+                    changeAddress = cold->user_group[0].address.View();
+                    change = std::to_string(changle);
+            scriptAmount = std::to_string(amount1*2 - 0.01);
                 }
                 else
                 {
                     changle = -changle;
-                    response["changeAddress"] = g_mapGameInfo[roomid]->user_group[0]->address;
-                    response["change"] = std::to_string(changle);
-            response["scriptAmount"] = std::to_string(amount0*2 - 0.01);
+                    changeAddress = cold->user_group[0].address.View();
+                    change = std::to_string(changle);
+            scriptAmount = std::to_string(amount0*2 - 0.01);
                 }
-		
-		
 
-                response["hexTx"] = g_mapGameInfo[roomid]->fund_tx;
-                strReply = response.dump();
+                // keys in the order the v1 replies always had
+                req->WriteHeaders(JSON_HEADERS);
+                JsonWriter w(req->ReplyBuffer());
+                beginDataReply(w, ret_code, v2);
+                w.BeginObject();
+                for(int i =0;i<game_info->user_size;i++)
+                   w.Key(amount + std::to_string(i)).String(formatAmount(cold->user_group[i].amount));
+                w.Key("change").String(change);
+                w.Key("changeAddress").String(changeAddress);
+                w.Key("hexTx").Hex((const unsigned char*)cold->fund_tx.data, cold->fund_tx.len);
+                w.Key("scriptAmount").String(scriptAmount);
+                for(int i =0;i<game_info->user_size;i++)
+                {
+                   const UserInfo& user = cold->user_group[i];
+                   w.Key(txid + std::to_string(i)).Hex(user.txid.data(), uint256::WIDTH);
+                }
+                for(int i =0;i<game_info->user_size;i++)
+                   w.Key(vout + std::to_string(i)).Int(cold->user_group[i].vout);
+                w.EndObject();
+                endDataReply(w, v2);
+                req->WriteReply(HTTP_OK);
+                return;
             }
         }
         else
@@ -693,10 +1981,8 @@ void getFundTx(std::unique_ptr<HTTPRequest> req)
             strReply = "No such roomid!";
         }
 
-        std::string result = makeReplyMsg(ret_code,strReply);
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
-
+        writeMessageReply(req.get(),ret_code,strReply);
+        return;
     }
     catch(...)
     {
@@ -711,35 +1997,37 @@ void anounceSecret(std::unique_ptr<HTTPRequest> req)
 {
     try
     {
-        std::string post_data = req->ReadBody();
-        std::cout << "anounceSecret receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
-
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " anounceSecret  params error\n ";
-            throw;
-        }
+        std::string_view post_data = req->GetBody();
+        LOG(DEBUG) << "anounceSecret receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        AnounceSecretParams params;
+        if (!decodeParams(req.get(), decoder, anounceSecretFields, &params))
+            return;
 
-        int roomid = jsonData["roomid"].get<int>();
-        int num = jsonData["num"].get<int>();
-        int uid = jsonData["uid"].get<int>();
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
+        uint64_t roomid = params.roomid;
+        int num = params.num;
+        int uid = params.uid;
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = g_rooms.Get(roomid);
         std::string strReply;
 	int ret_code =0;
-        if ( iter != g_mapGameInfo.end())
+        if (game_info)
         {
-            if(iter->second->user_size != 2)
+            if(game_info->user_size != 2)
             {
 		ret_code=1;
                 strReply = "No one palys with you!";
             }
+            else if(uid < 0 || uid >= game_info->user_size)
+            {
+                ret_code=2;
+                strReply = "No such uid!";
+            }
             else
             {
                 strReply = "OK!";
-                if(g_mapGameInfo[roomid]->anounce_size !=2)
-                    g_mapGameInfo[roomid]->anounce_size++;
-                g_mapGameInfo[roomid]->user_group[uid]->num = num;
+                anounceRoom(game_info,uid,num);
+                logRoom(LOG_ROOM_ANOUNCE,roomid,uid);
             }
         }
         else
@@ -747,9 +2035,7 @@ void anounceSecret(std::unique_ptr<HTTPRequest> req)
             ret_code=2;
             strReply = "No such roomid!";
         }
-        std::string result = makeReplyMsg(ret_code,strReply);
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
+        writeMessageReply(req.get(),ret_code,strReply);
         return;
     }
     catch(...)
@@ -765,36 +2051,39 @@ void getNum(std::unique_ptr<HTTPRequest> req)
 {
     try
     {
-        std::string post_data = req->ReadBody();
-        std::cout << "getNum receive:"  <<  post_data << std::endl;
-        auto jsonData = json::parse(post_data);
-        if(!jsonData.is_object())
-        {
-            LOG(ERROR) << " getNum  params error\n ";
-            throw;
-        }
-        int roomid = jsonData["roomid"].get<int>();
-        std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
+        std::string_view post_data = req->GetBody();
+        LOG(DEBUG) << "getNum receive:"  <<  post_data;
+        RequestDecoder decoder(post_data);
+        RoomParams params;
+        if (!decodeParams(req.get(), decoder, roomFields, &params))
+            return;
+        uint64_t roomid = params.roomid;
+        std::lock_guard<std::mutex> lock(cs_gameinfo);
+        GameInfo* game_info = g_rooms.Get(roomid);
         std::string strReply;
 	int ret_code = 0;
-        if ( iter != g_mapGameInfo.end())
+        if (game_info)
         {
-            if(iter->second->anounce_size != 2)
+            if(game_info->anounce_size != 2)
             {
 		ret_code = 1;
                 strReply = "No one palys with you!";
             }
             else
             {
-                strReply = "OK!";
-                json response = json::object();
+                bool v2 = isV2(req.get());
                 std::string secret="secret";
-                for(int i =0;i<g_mapGameInfo[roomid]->user_group.size();i++)
-                {
-                   response[secret + std::to_string(i)] = g_mapGameInfo[roomid]->user_group[i]->num;
-                }
-
-                strReply = response.dump();
+                RoomCold* cold = roomCold(roomid);
+                req->WriteHeaders(JSON_HEADERS);
+                JsonWriter w(req->ReplyBuffer());
+                beginDataReply(w, ret_code, v2);
+                w.BeginObject();
+                for(int i =0;i<game_info->user_size;i++)
+                   w.Key(secret + std::to_string(i)).Int(cold->user_group[i].num);
+                w.EndObject();
+                endDataReply(w, v2);
+                req->WriteReply(HTTP_OK);
+                return;
             }
         }
         else
@@ -802,9 +2091,7 @@ void getNum(std::unique_ptr<HTTPRequest> req)
 	    ret_code = 2;
             strReply = "No such roomid!";
         }
-        std::string result = makeReplyMsg(ret_code,strReply);
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK,result);
+        writeMessageReply(req.get(),ret_code,strReply);
         return;
     }
     catch(...)
@@ -819,24 +2106,23 @@ void signFundTx(std::unique_ptr<HTTPRequest> req)
 {
     try
         {
-            std::string post_data = req->ReadBody();
-            std::cout << "signFundTx receive:"  <<  post_data << std::endl;
-            auto jsonData = json::parse(post_data);
-
-            if(!jsonData.is_object())
-            {
-                LOG(ERROR) << " signFundTx  params error\n ";
-                throw;
-            }
-
-            int roomid = jsonData["roomid"].get<int>();
-            std::string hexTx = jsonData["hex"].get<std::string>();
-            std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(roomid);
+            std::string_view post_data = req->GetBody();
+            LOG(DEBUG) << "signFundTx receive:"  <<  post_data;
+            RequestDecoder decoder(post_data);
+            SignFundTxParams params;
+            unsigned char tx[ROOM_FUND_TX_MAX];
+            params.tx.data = tx;
+            if (!decodeParams(req.get(), decoder, signFundTxFields, &params))
+                return;
+
+            uint64_t roomid = params.roomid;
+            std::lock_guard<std::mutex> lock(cs_gameinfo);
+            GameInfo* game_info = g_rooms.Get(roomid);
             std::string strReply;
             int ret_code =0 ;
-            if ( iter != g_mapGameInfo.end())
+            if (game_info)
             {
-                if(iter->second->user_size != 2)
+                if(game_info->user_size != 2)
                 {
                     ret_code =1;
                     strReply = "No one palys with you!";
@@ -844,7 +2130,8 @@ void signFundTx(std::unique_ptr<HTTPRequest> req)
                 else
                 {
                     strReply = "OK!";
-                    g_mapGameInfo[roomid]->fund_tx = hexTx;
+                    signRoom(game_info,params.tx.data,params.tx.len);
+                    logRoom(LOG_ROOM_SIGN,roomid);
                 }
             }
             else
@@ -852,9 +2139,7 @@ void signFundTx(std::unique_ptr<HTTPRequest> req)
 		ret_code = 2;
                 strReply = "No such roomid!";
             }
-            std::string result = makeReplyMsg(ret_code,strReply);
-            req->WriteHeader("Content-Type", "application/json");
-            req->WriteReply(HTTP_OK,result);
+            writeMessageReply(req.get(),ret_code,strReply);
             return;
         }
         catch(...)
@@ -864,19 +2149,18 @@ void signFundTx(std::unique_ptr<HTTPRequest> req)
         req->WriteReply(HTTP_INTERNAL,ERROR_REQUEST);
 }
 
-static void releaseRoom(int room_id)
+static void releaseRoom(uint64_t room_id)
 {
-     std::map<int ,GameInfo*>::iterator iter = g_mapGameInfo.find(room_id);
+     GameInfo* game_info = g_rooms.Get(room_id);
 
-     if ( iter != g_mapGameInfo.end() )
+     if ( game_info )
      {
-         for ( int i =0 ; i<g_mapGameInfo[room_id]->user_group.size() ;++i )
-         {
-             delete g_mapGameInfo[room_id]->user_group[i];
-         }
-
-         delete g_mapGameInfo[room_id];
-         g_mapGameInfo.erase(room_id);
+         removeWaitingRoom(game_info);
+         g_roomTimers.Cancel(&game_info->timer);
+         if (game_info->phase != ROOM_COMPLETE)
+             addRoomGauge(ROOMS_LIVE, -1);
+         addRoomGauge(ROOMS_TOTAL, -1);
+         g_rooms.Erase(room_id);
      }
 
 }
@@ -0,0 +1,179 @@
+#include "snapshot.h"
+#include "easylogging++.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string snapshotPath(const std::string& dir, uint64_t seq)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "snapshot-%012llu.snap", (unsigned long long)seq);
+    return dir + "/" + name;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& dir, uint64_t seq):fd_(-1), used_(0), ok_(true)
+{
+    std::string path = snapshotPath(dir, seq);
+    snprintf(dir_, sizeof(dir_), "%s", dir.c_str());
+    snprintf(path_, sizeof(path_), "%s", path.c_str());
+    snprintf(tmpPath_, sizeof(tmpPath_), "%s.tmp", path.c_str());
+}
+
+bool SnapshotWriter::Open()
+{
+    fd_ = open(tmpPath_, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    return fd_ >= 0;
+}
+
+bool SnapshotWriter::Flush()
+{
+    const char* p = buf_;
+    while (ok_ && used_)
+    {
+        ssize_t n = write(fd_, p, used_);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            ok_ = false;
+        else
+        {
+            p += n;
+            used_ -= n;
+        }
+    }
+    used_ = 0;
+    return ok_;
+}
+
+bool SnapshotWriter::Write(const void* p, size_t len)
+{
+    const char* src = (const char*)p;
+    while (ok_ && len)
+    {
+        size_t n = std::min(len, sizeof(buf_) - used_);
+        memcpy(buf_ + used_, src, n);
+        used_ += n;
+        src += n;
+        len -= n;
+        if (used_ == sizeof(buf_))
+            Flush();
+    }
+    return ok_;
+}
+
+bool SnapshotWriter::Commit()
+{
+    if (!Flush() || fsync(fd_) != 0)
+        ok_ = false;
+    close(fd_);
+    fd_ = -1;
+    if (!ok_ || rename(tmpPath_, path_) != 0)
+    {
+        unlink(tmpPath_);
+        return false;
+    }
+    int dfd = open(dir_, O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0)
+    {
+        fsync(dfd);
+        close(dfd);
+    }
+    return true;
+}
+
+SnapshotFile::SnapshotFile():base_(nullptr), size_(0)
+{
+}
+
+SnapshotFile::~SnapshotFile()
+{
+    if (base_)
+        munmap((void*)base_, size_);
+}
+
+bool SnapshotFile::Open(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+    size_ = st.st_size;
+    void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    base_ = (const char*)map;
+
+    const SnapshotHeader& h = Header();
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != SNAPSHOT_VERSION ||
+        h.headerSize != sizeof(SnapshotHeader) || h.roomSize != sizeof(SnapshotRoom) || h.fileSize != size_ ||
+        h.generationsOffset + (uint64_t)h.capacity * sizeof(uint32_t) > size_ ||
+        h.roomsOffset + (uint64_t)h.roomCount * sizeof(SnapshotRoom) > size_ ||
+        h.roomsOffset % alignof(SnapshotRoom) != 0)
+    {
+        LOG(ERROR) << "snapshot: " << path << " has a bad header";
+        return false;
+    }
+    return true;
+}
+
+static bool parseSnapshotName(const char* name, uint64_t& seq, bool& tmp)
+{
+    unsigned long long n;
+    int len = 0;
+    if (sscanf(name, "snapshot-%12llu.snap%n", &n, &len) != 1 || len == 0)
+        return false;
+    seq = n;
+    tmp = strcmp(name + len, ".tmp") == 0;
+    return tmp || name[len] == 0;
+}
+
+bool findSnapshot(const std::string& dir, uint64_t& seq)
+{
+    bool found = false;
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    while (struct dirent* e = readdir(d))
+    {
+        uint64_t s;
+        bool tmp;
+        if (parseSnapshotName(e->d_name, s, tmp) && !tmp && (!found || s > seq))
+        {
+            seq = s;
+            found = true;
+        }
+    }
+    closedir(d);
+    return found;
+}
+
+void pruneSnapshots(const std::string& dir, uint64_t seq)
+{
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent* e = readdir(d))
+    {
+        uint64_t s;
+        bool tmp;
+        if (parseSnapshotName(e->d_name, s, tmp) && (s < seq || (tmp && s <= seq)))
+        {
+            std::string path = dir + "/" + e->d_name;
+            if (unlink(path.c_str()) != 0)
+                LOG(WARNING) << "snapshot: cannot remove " << path << ": " << strerror(errno);
+        }
+    }
+    closedir(d);
+}
@@ -0,0 +1,109 @@
+#include "timerwheel.h"
+
+static const uint64_t SLOT_MASK = TimerWheel::SLOTS - 1;
+
+static void unlink(TimerNode* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+}
+
+TimerWheel::TimerWheel(ExpireFn onExpire):now_(0), onExpire_(onExpire)
+{
+    for (int l = 0; l < LEVELS; l++)
+    {
+        for (int s = 0; s < SLOTS; s++)
+        {
+            slots_[l][s].prev = &slots_[l][s];
+            slots_[l][s].next = &slots_[l][s];
+        }
+    }
+}
+
+void TimerWheel::Insert(TimerNode* node)
+{
+    uint64_t delta = node->expires > now_ ? node->expires - now_ : 0;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= ((uint64_t)1 << (BITS * (level + 1))))
+        level++;
+
+    // beyond the top level's range: park in the furthest slot, it is
+    // re-filed when that slot cascades
+    uint64_t when = node->expires;
+    if (delta >= ((uint64_t)1 << (BITS * LEVELS)))
+        when = now_ + ((uint64_t)1 << (BITS * LEVELS)) - 1;
+
+    TimerNode* head = &slots_[level][(when >> (BITS * level)) & SLOT_MASK];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimerWheel::Schedule(TimerNode* node, uint64_t ticks)
+{
+    if (node->IsActive())
+        unlink(node);
+    node->expires = now_ + ticks;
+    Insert(node);
+}
+
+void TimerWheel::Cancel(TimerNode* node)
+{
+    if (node->IsActive())
+        unlink(node);
+}
+
+void TimerWheel::Cascade(int level, int slot)
+{
+    TimerNode* head = &slots_[level][slot];
+    TimerNode list;
+    if (head->next == head)
+        return;
+
+    // detach the whole slot first, Insert may put nodes back into it
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->next = head->prev = head;
+
+    while (list.next != &list)
+    {
+        TimerNode* node = list.next;
+        unlink(node);
+        Insert(node);
+    }
+}
+
+void TimerWheel::Tick()
+{
+    now_++;
+    int idx = now_ & SLOT_MASK;
+    if (idx == 0)
+    {
+        for (int level = 1; level < LEVELS; level++)
+        {
+            int slot = (now_ >> (BITS * level)) & SLOT_MASK;
+            Cascade(level, slot);
+            if (slot != 0)
+                break;
+        }
+    }
+
+    TimerNode* head = &slots_[0][idx];
+    while (head->next != head)
+    {
+        TimerNode* node = head->next;
+        unlink(node);
+        onExpire_(node);
+    }
+}
+
+void TimerWheel::Advance(uint64_t tick)
+{
+    while (now_ < tick)
+        Tick();
+}
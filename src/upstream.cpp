@@ -0,0 +1,226 @@
+#include "upstream.h"
+#include "easylogging++.h"
+#include <algorithm>
+
+UpstreamClient::UpstreamClient():
+    base_(nullptr), multi_(nullptr), timer_(nullptr), wake_(nullptr), stopped_(true), inFlight_(0)
+{
+}
+
+UpstreamClient::~UpstreamClient()
+{
+    Stop();
+}
+
+bool UpstreamClient::Start(struct event_base* base, long maxHostConnections)
+{
+    base_ = base;
+    multi_ = curl_multi_init();
+    timer_ = evtimer_new(base, TimeoutCb, this);
+    wake_ = event_new(base, -1, 0, WakeCb, this);
+    if (!multi_ || !timer_ || !wake_)
+    {
+        Stop();
+        return false;
+    }
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, SocketCb);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, TimerCb);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, maxHostConnections);
+    std::lock_guard<std::mutex> lock(mtx_);
+    stopped_ = false;
+    return true;
+}
+
+void UpstreamClient::Stop()
+{
+    std::vector<UpstreamCall*> calls;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stopped_ = true;
+        calls.swap(submitted_);
+    }
+    for (UpstreamCall* call : running_)
+    {
+        curl_multi_remove_handle(multi_, call->easy);
+        calls.push_back(call);
+    }
+    running_.clear();
+    for (UpstreamCall* call : calls)
+        Finish(call, CURLE_ABORTED_BY_CALLBACK);
+
+    if (wake_)
+        event_free(wake_);
+    if (timer_)
+        event_free(timer_);
+    if (multi_)
+        curl_multi_cleanup(multi_);
+    wake_ = timer_ = nullptr;
+    multi_ = nullptr;
+}
+
+UpstreamCall* UpstreamClient::NewCall(CurlPool& pool)
+{
+    CURL* easy = pool.Acquire();
+    if (!easy)
+        return nullptr;
+    return new UpstreamCall{&pool, easy, std::string(), nullptr, nullptr, std::string(), nullptr};
+}
+
+void UpstreamClient::Perform(UpstreamCall* call, UpstreamDone done)
+{
+    call->done = std::move(done);
+    curl_easy_setopt(call->easy, CURLOPT_PRIVATE, call);
+    curl_easy_setopt(call->easy, CURLOPT_WRITEFUNCTION, WriteCb);
+    curl_easy_setopt(call->easy, CURLOPT_WRITEDATA, call);
+    inFlight_++;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!stopped_)
+        {
+            submitted_.push_back(call);
+            // coalesces with any wakeup still pending
+            event_active(wake_, EV_READ, 0);
+            return;
+        }
+    }
+    Finish(call, CURLE_ABORTED_BY_CALLBACK);
+}
+
+void UpstreamClient::WakeCb(evutil_socket_t fd, short events, void* arg)
+{
+    UpstreamClient* client = (UpstreamClient*)arg;
+    std::vector<UpstreamCall*> calls;
+    {
+        std::lock_guard<std::mutex> lock(client->mtx_);
+        calls.swap(client->submitted_);
+    }
+    for (UpstreamCall* call : calls)
+    {
+        CURLMcode rc = curl_multi_add_handle(client->multi_, call->easy);
+        if (rc != CURLM_OK)
+        {
+            LOG(ERROR) << "upstream: cannot start transfer: " << curl_multi_strerror(rc);
+            client->Finish(call, CURLE_FAILED_INIT);
+            continue;
+        }
+        client->running_.push_back(call);
+    }
+}
+
+size_t UpstreamClient::WriteCb(char* data, size_t size, size_t nmemb, void* arg)
+{
+    ((UpstreamCall*)arg)->reply.append(data, size * nmemb);
+    return size * nmemb;
+}
+
+int UpstreamClient::SocketCb(CURL* easy, curl_socket_t s, int what, void* arg, void* socketp)
+{
+    UpstreamClient* client = (UpstreamClient*)arg;
+    struct event* ev = (struct event*)socketp;
+    if (what == CURL_POLL_REMOVE)
+    {
+        if (ev)
+            event_free(ev);
+        curl_multi_assign(client->multi_, s, nullptr);
+        return 0;
+    }
+
+    short events = EV_PERSIST;
+    if (what & CURL_POLL_IN)
+        events |= EV_READ;
+    if (what & CURL_POLL_OUT)
+        events |= EV_WRITE;
+    if (ev)
+    {
+        event_del(ev);
+        event_assign(ev, client->base_, s, events, EventCb, client);
+    }
+    else
+    {
+        ev = event_new(client->base_, s, events, EventCb, client);
+        if (!ev)
+            return -1;
+        curl_multi_assign(client->multi_, s, ev);
+    }
+    event_add(ev, nullptr);
+    return 0;
+}
+
+int UpstreamClient::TimerCb(CURLM* multi, long timeoutMs, void* arg)
+{
+    UpstreamClient* client = (UpstreamClient*)arg;
+    if (timeoutMs < 0)
+    {
+        evtimer_del(client->timer_);
+        return 0;
+    }
+    struct timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    evtimer_add(client->timer_, &tv);
+    return 0;
+}
+
+void UpstreamClient::EventCb(evutil_socket_t fd, short events, void* arg)
+{
+    UpstreamClient* client = (UpstreamClient*)arg;
+    int action = 0;
+    if (events & EV_READ)
+        action |= CURL_CSELECT_IN;
+    if (events & EV_WRITE)
+        action |= CURL_CSELECT_OUT;
+    int running;
+    curl_multi_socket_action(client->multi_, fd, action, &running);
+    client->CheckDone();
+    if (running == 0)
+        evtimer_del(client->timer_);
+}
+
+void UpstreamClient::TimeoutCb(evutil_socket_t fd, short events, void* arg)
+{
+    UpstreamClient* client = (UpstreamClient*)arg;
+    int running;
+    curl_multi_socket_action(client->multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+    client->CheckDone();
+}
+
+void UpstreamClient::CheckDone()
+{
+    CURLMsg* msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi_, &left)))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        CURL* easy = msg->easy_handle;
+        CURLcode code = msg->data.result;
+        UpstreamCall* call = nullptr;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&call);
+        curl_multi_remove_handle(multi_, easy);
+        running_.erase(std::find(running_.begin(), running_.end(), call));
+        Finish(call, code);
+    }
+}
+
+void UpstreamClient::Finish(UpstreamCall* call, CURLcode code)
+{
+    long status = 0;
+    if (code == CURLE_OK)
+        curl_easy_getinfo(call->easy, CURLINFO_RESPONSE_CODE, &status);
+    try
+    {
+        if (call->done)
+            call->done(code, status, call->reply);
+    }
+    catch(...)
+    {
+        LOG(ERROR) << "upstream: reply callback threw";
+    }
+    // the handle forgets the request before its buffers go
+    curl_easy_reset(call->easy);
+    curl_slist_free_all(call->headers);
+    curl_mime_free(call->mime);
+    call->pool->Release(call->easy);
+    delete call;
+    inFlight_--;
+}
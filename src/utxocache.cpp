@@ -0,0 +1,84 @@
+#include "utxocache.h"
+
+UtxoCache::UtxoCache():
+    capacity_(65536), negativeTtl_(10), epoch_(0)
+{
+}
+
+void UtxoCache::SetLimits(size_t capacity, int negativeTtlSeconds)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    capacity_ = capacity;
+    negativeTtl_ = std::chrono::seconds(negativeTtlSeconds);
+    while (lru_.size() > capacity_)
+    {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+UtxoState UtxoCache::Lookup(const uint256& txid, uint32_t vout, int64_t& value, uint64_t& epoch)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    epoch = epoch_;
+    auto it = index_.find(Key{txid, vout});
+    if (it == index_.end())
+        return UTXO_UNKNOWN;
+    Entry& entry = *it->second;
+    if (entry.state == UTXO_MISSING && entry.expires <= std::chrono::steady_clock::now())
+    {
+        lru_.erase(it->second);
+        index_.erase(it);
+        return UTXO_UNKNOWN;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    value = entry.value;
+    return entry.state;
+}
+
+void UtxoCache::Put(const uint256& txid, uint32_t vout, UtxoState state, int64_t value, uint64_t epoch)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (epoch != epoch_ || capacity_ == 0 || state == UTXO_UNKNOWN)
+        return;
+    Key key{txid, vout};
+    auto expires = std::chrono::steady_clock::now() + negativeTtl_;
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+        // another request for the same output got there first
+        *it->second = Entry{key, state, value, expires};
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    if (lru_.size() >= capacity_)
+    {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+    lru_.push_front(Entry{key, state, value, expires});
+    index_.emplace(key, lru_.begin());
+}
+
+bool UtxoCache::SetTip(const std::string& tip)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (tip == tip_)
+        return false;
+    tip_ = tip;
+    Clear();
+    return true;
+}
+
+size_t UtxoCache::Size()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return lru_.size();
+}
+
+void UtxoCache::Clear()
+{
+    lru_.clear();
+    index_.clear();
+    epoch_++;
+}
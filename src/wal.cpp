@@ -0,0 +1,339 @@
+#include "wal.h"
+#include "easylogging++.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t WAL_HEADER_SIZE = 9;
+const size_t WAL_MAX_RECORD = 1 << 20;
+// a batch this big is flushed without waiting for the window to end
+const size_t WAL_FLUSH_BYTES = 4 << 20;
+// appenders wait for the flusher past this, rather than grow without bound
+const size_t WAL_MAX_PENDING = 64 << 20;
+
+uint32_t crcTable[256];
+
+void initCrcTable()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c >> 1) ^ (0x82f63b78 & (0 - (c & 1)));
+        crcTable[i] = c;
+    }
+}
+
+uint32_t crc32c(uint32_t crc, const unsigned char* p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+struct Wal
+{
+    std::string dir;
+    // written by open, close and the flusher's segment switch, read
+    // unlocked by appenders and the flusher's writes
+    std::atomic<int> fd{-1};
+    int syncMs = 10;
+    std::mutex mtx;
+    std::condition_variable wake;       // flusher: work to do
+    std::condition_variable drained;    // appenders: pending shrank
+    std::vector<unsigned char> pending;
+    uint64_t seq = 0;                   // segment appends go to
+    // rotateWal moves what belongs to the old segment here and opens
+    // segment seq as nextFd; the flusher writes sealed, then switches fd
+    std::vector<unsigned char> sealed;
+    int nextFd = -1;
+    bool rotating = false;
+    bool stop = false;
+    std::thread flusher;
+};
+
+Wal wal;
+
+std::string segmentPath(uint64_t seq)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "wal-%012llu.log", (unsigned long long)seq);
+    return wal.dir + "/" + name;
+}
+
+std::vector<uint64_t> listSegments()
+{
+    std::vector<uint64_t> segments;
+    DIR* d = opendir(wal.dir.c_str());
+    if (!d)
+        return segments;
+    while (struct dirent* e = readdir(d))
+    {
+        unsigned long long seq;
+        char tail;
+        if (sscanf(e->d_name, "wal-%12llu.lo%c", &seq, &tail) == 2 && tail == 'g')
+            segments.push_back(seq);
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+bool writeAll(int fd, const unsigned char* p, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// makes a newly created file's directory entry durable
+void syncDir()
+{
+    int fd = open(wal.dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Replays one segment. Returns the offset of the first byte that is not part
+// of a whole, intact record; size when the segment is clean.
+size_t replaySegment(const std::string& path, WalReplayFn replay, uint64_t& records, size_t& size)
+{
+    size = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    const unsigned char* base = (const unsigned char*)map;
+    size_t off = 0;
+    while (size - off >= WAL_HEADER_SIZE)
+    {
+        uint32_t len, crc;
+        memcpy(&len, base + off, 4);
+        memcpy(&crc, base + off + 4, 4);
+        if (len > WAL_MAX_RECORD || size - off - WAL_HEADER_SIZE < len)
+            break;
+        const unsigned char* rec = base + off + 8;
+        if (crc32c(0, rec, len + 1) != crc)
+            break;
+        replay(rec[0], rec + 1, len);
+        records++;
+        off += WAL_HEADER_SIZE + len;
+    }
+    munmap(map, size);
+    return off;
+}
+
+void flushLoop()
+{
+    std::vector<unsigned char> batch;
+    std::unique_lock<std::mutex> lock(wal.mtx);
+    while (true)
+    {
+        auto ready = [] { return wal.stop || wal.rotating || wal.pending.size() >= WAL_FLUSH_BYTES ||
+                                 (wal.syncMs == 0 && !wal.pending.empty()); };
+        if (wal.syncMs > 0)
+            wal.wake.wait_for(lock, std::chrono::milliseconds(wal.syncMs), ready);
+        else
+            wal.wake.wait(lock, ready);
+
+        if (wal.rotating)
+        {
+            batch.swap(wal.sealed);
+            int fd = wal.nextFd;
+            lock.unlock();
+            if (!writeAll(wal.fd, batch.data(), batch.size()) || fdatasync(wal.fd) != 0)
+                LOG(ERROR) << "wal write error: " << strerror(errno);
+            batch.clear();
+            syncDir();
+            lock.lock();
+            close(wal.fd);
+            wal.fd = fd;
+            wal.nextFd = -1;
+            wal.rotating = false;
+            wal.drained.notify_all();
+        }
+
+        if (wal.pending.empty())
+        {
+            if (wal.stop)
+                break;
+            continue;
+        }
+        batch.swap(wal.pending);
+        wal.drained.notify_all();
+        lock.unlock();
+
+        if (!writeAll(wal.fd, batch.data(), batch.size()) || fdatasync(wal.fd) != 0)
+            LOG(ERROR) << "wal write error: " << strerror(errno);
+        batch.clear();
+
+        lock.lock();
+    }
+}
+
+}
+
+bool openWal(const std::string& dir, int syncMs, uint64_t fromSeq, WalReplayFn replay)
+{
+    initCrcTable();
+    wal.dir = dir;
+    wal.syncMs = syncMs;
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        LOG(ERROR) << "wal: cannot create " << dir << ": " << strerror(errno);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> segments = listSegments();
+    segments.erase(segments.begin(), std::lower_bound(segments.begin(), segments.end(), fromSeq));
+    uint64_t records = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        std::string path = segmentPath(segments[i]);
+        size_t size;
+        size_t good = replaySegment(path, replay, records, size);
+        if (good == size)
+            continue;
+        if (i + 1 != segments.size())
+        {
+            LOG(ERROR) << "wal: " << path << " is corrupt at offset " << good;
+            return false;
+        }
+        LOG(WARNING) << "wal: dropping " << size - good << " bytes of torn tail from " << path;
+        if (truncate(path.c_str(), good) != 0)
+        {
+            LOG(ERROR) << "wal: cannot truncate " << path << ": " << strerror(errno);
+            return false;
+        }
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    LOG(INFO) << "wal: replayed " << records << " records from " << segments.size() << " segments in " << ms << "ms";
+
+    wal.seq = segments.empty() ? std::max<uint64_t>(fromSeq, 1) : segments.back();
+    std::string path = segmentPath(wal.seq);
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG(ERROR) << "wal: cannot open " << path << ": " << strerror(errno);
+        return false;
+    }
+    syncDir();
+    wal.fd = fd;
+    wal.stop = false;
+    wal.flusher = std::thread(flushLoop);
+    return true;
+}
+
+void walAppend(uint8_t type, const void* payload, size_t len)
+{
+    if (wal.fd < 0 || len > WAL_MAX_RECORD)
+        return;
+    unsigned char header[WAL_HEADER_SIZE];
+    uint32_t len32 = len;
+    memcpy(header, &len32, 4);
+    header[8] = type;
+    uint32_t crc = crc32c(crc32c(0, header + 8, 1), (const unsigned char*)payload, len);
+    memcpy(header + 4, &crc, 4);
+
+    std::unique_lock<std::mutex> lock(wal.mtx);
+    wal.drained.wait(lock, [] { return wal.pending.size() < WAL_MAX_PENDING || wal.stop; });
+    wal.pending.insert(wal.pending.end(), header, header + WAL_HEADER_SIZE);
+    wal.pending.insert(wal.pending.end(), (const unsigned char*)payload, (const unsigned char*)payload + len);
+    if (wal.syncMs == 0 || wal.pending.size() >= WAL_FLUSH_BYTES)
+        wal.wake.notify_one();
+}
+
+uint64_t rotateWal()
+{
+    std::unique_lock<std::mutex> lock(wal.mtx);
+    if (wal.fd < 0)
+        return 0;
+    wal.drained.wait(lock, [] { return !wal.rotating || wal.stop; });
+    // opened here so that a failure reaches the caller before it snapshots
+    std::string path = segmentPath(wal.seq + 1);
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG(ERROR) << "wal: cannot open " << path << ": " << strerror(errno);
+        return 0;
+    }
+    wal.sealed.swap(wal.pending);
+    wal.pending.clear();
+    wal.nextFd = fd;
+    wal.rotating = true;
+    wal.seq++;
+    wal.wake.notify_one();
+    return wal.seq;
+}
+
+void pruneWal(uint64_t seq)
+{
+    for (uint64_t s : listSegments())
+    {
+        if (s >= seq)
+            break;
+        std::string path = segmentPath(s);
+        if (unlink(path.c_str()) != 0)
+            LOG(WARNING) << "wal: cannot remove " << path << ": " << strerror(errno);
+    }
+}
+
+bool isWalOpen()
+{
+    return wal.fd >= 0;
+}
+
+void closeWal()
+{
+    if (wal.fd < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(wal.mtx);
+        wal.stop = true;
+    }
+    wal.wake.notify_one();
+    wal.flusher.join();
+    close(wal.fd);
+    wal.fd = -1;
+}